@@ -0,0 +1,33 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "bench.h"
+
+double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int bench_stdout = -1;
+FILE *bench_capture;
+
+void bench_capture_begin(void)
+{
+    fflush(stdout);
+    bench_stdout = dup(fileno(stdout));
+    bench_capture = tmpfile();
+    dup2(fileno(bench_capture), fileno(stdout));
+}
+
+long bench_capture_end(void)
+{
+    fflush(stdout);
+    long n = lseek(fileno(stdout), 0, SEEK_END);
+
+    dup2(bench_stdout, fileno(stdout));
+    close(bench_stdout);
+    fclose(bench_capture);
+    return n;
+}
@@ -0,0 +1,14 @@
+#ifndef LISPY_BENCH_H
+#define LISPY_BENCH_H
+
+// Helpers shared by the benchmarks
+
+// Seconds on a monotonic clock
+double bench_now(void);
+
+// Sends stdout to a temporary file until bench_capture_end, which returns
+// the number of bytes written to it
+void bench_capture_begin(void);
+long bench_capture_end(void);
+
+#endif // LISPY_BENCH_H
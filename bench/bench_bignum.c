@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "lispy.h"
+#include "bench.h"
+
+// Evaluates src, which the reader NUL-terminates tokens of in place while
+// converting them, and returns the best time of a few runs. The last value
+// is kept in *x.
+double bench_eval(lenv *e, char *src, int runs, lval **x)
+{
+    double best = 1e30;
+    *x = NULL;
+
+    for (int i = 0; i < runs; i++)
+    {
+        lval *form = lval_read_str(src);
+
+        double t = bench_now();
+        lval *r = lval_eval(e, form);
+        t = bench_now() - t;
+        best = t < best ? t : best;
+
+        if (*x)
+            lval_del(*x);
+        *x = r;
+    }
+
+    return best;
+}
+
+// factorial(10000), as the product of a range, and printing it in base 10,
+// then a product of two operands of about 10000 limbs each, which is done by
+// Karatsuba multiplication rather than the one-limb steps of the factorial.
+// Each is timed over a few runs and the best is reported.
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 5;
+
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    char factorial[] = "(product (range 1 10001))";
+    char operands[] = "(def {a b} (^ 3 200000) (^ 7 113000))";
+    char product[] = "(* a b)";
+
+    lval *x;
+    double compute = bench_eval(e, factorial, runs, &x);
+    if (x->type != LVAL_BIG)
+    {
+        lval_println(x);
+        return 1;
+    }
+
+    double print = 1e30;
+    long digits = 0;
+
+    for (int i = 0; i < runs; i++)
+    {
+        bench_capture_begin();
+        double t = bench_now();
+        lval_print(x);
+        fflush(stdout);
+        t = bench_now() - t;
+        digits = bench_capture_end();
+        print = t < print ? t : print;
+    }
+
+    lval_del(x);
+
+    lval_del(lval_eval(e, lval_read_str(operands)));
+    double mul = bench_eval(e, product, runs, &x);
+    if (x->type != LVAL_BIG)
+    {
+        lval_println(x);
+        return 1;
+    }
+
+    printf("factorial(10000), %ld digits, best of %d\n", digits, runs);
+    printf("  compute %10.3f ms\n", compute * 1e3);
+    printf("  print   %10.3f ms\n", print * 1e3);
+    printf("3^200000 * 7^113000, %d limbs, best of %d\n", x->size, runs);
+    printf("  compute %10.3f ms\n", mul * 1e3);
+
+    lval_del(x);
+    lenv_del(e);
+    return 0;
+}
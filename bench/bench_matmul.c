@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "lispy.h"
+#include "bench.h"
+
+// matmul on square matrices of random doubles, reported as GFLOP/s from the
+// 2n^3 multiply-adds it does. The sizes default to a spread up to the
+// 2000x2000 matrices it is meant for, and can be given after the run count.
+lval *bench_mat(long n)
+{
+    double *d = malloc(sizeof(double) * n * n);
+    for (long i = 0; i < n * n; i++)
+        d[i] = (double)rand() / RAND_MAX - 0.5;
+
+    return lval_mat(n, n, d);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 3;
+
+    long sizes[] = {64, 256, 512, 1000, 2000};
+    int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    printf("matmul, best of %d\n", runs);
+
+    for (int s = 0; s < (argc > 2 ? argc - 2 : nsizes); s++)
+    {
+        long n = argc > 2 ? atol(argv[s + 2]) : sizes[s];
+        lval *a = bench_mat(n);
+        lval *b = bench_mat(n);
+        double best = 1e30;
+
+        for (int i = 0; i < runs; i++)
+        {
+            lval *v = lval_add(lval_add(lval_sexpr(), lval_copy(a)), lval_copy(b));
+
+            double t = bench_now();
+            lval *x = builtin_matmul(e, v);
+            t = bench_now() - t;
+            best = t < best ? t : best;
+
+            if (x->type != LVAL_MAT)
+            {
+                lval_println(x);
+                return 1;
+            }
+
+            lval_del(x);
+        }
+
+        printf("  %5ld x %-5ld %10.3f ms %8.2f GFLOP/s\n", n, n,
+               best * 1e3, 2.0 * n * n * n / best / 1e9);
+
+        lval_del(a);
+        lval_del(b);
+    }
+
+    lenv_del(e);
+    return 0;
+}
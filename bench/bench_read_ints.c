@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lispy.h"
+#include "bench.h"
+
+// The reader over a file of 10M integers of every length that fits a long,
+// reported as integers and megabytes read per second. The file has one
+// Q-expression of BENCH_ROW integers per line and each line is read on its
+// own, so the lvals of only one are alive at a time. It is written the
+// first time if it does not exist, or another file can be given after the
+// run count.
+#define BENCH_INTS 10000000L
+#define BENCH_ROW 10000L
+
+void bench_write_ints(char *filename)
+{
+    FILE *f = fopen(filename, "w");
+    if (!f)
+    {
+        perror(filename);
+        exit(1);
+    }
+
+    srand(1);
+    for (long i = 0; i < BENCH_INTS; i += BENCH_ROW)
+    {
+        fputc('{', f);
+        for (long j = 0; j < BENCH_ROW; j++)
+        {
+            // Between 1 and 18 digits, a quarter of them negative
+            int digits = 1 + rand() % 18;
+            long x = rand() % 9 + 1;
+            for (int k = 1; k < digits; k++)
+                x = x * 10 + rand() % 10;
+
+            fprintf(f, j ? " %ld" : "%ld", rand() % 4 ? x : -x);
+        }
+        fputs("}\n", f);
+    }
+
+    fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 3;
+    char *filename = argc > 2 ? argv[2] : "bench_ints.lspy";
+
+    FILE *f = fopen(filename, "r");
+    if (f)
+        fclose(f);
+    else
+        bench_write_ints(filename);
+
+    long len;
+    char *input = lval_slurp(filename, &len);
+    if (!input)
+    {
+        perror(filename);
+        return 1;
+    }
+
+    long bytes = strlen(input);
+    long ints = 0;
+    double best = 1e30;
+
+    for (int i = 0; i < runs; i++)
+    {
+        ints = 0;
+        double t = bench_now();
+
+        for (char *line = input; *line;)
+        {
+            char *end = strchr(line, '\n');
+            if (end)
+                *end = '\0';
+
+            lval *x = lval_read_str(line);
+            if (!x)
+                return 1;
+
+            for (int j = 0; j < x->count; j++)
+                ints += x->cell[j]->type == LVAL_QEXPR ? x->cell[j]->count : 1;
+            lval_del(x);
+
+            if (!end)
+                break;
+            *end = '\n';
+            line = end + 1;
+        }
+
+        t = bench_now() - t;
+        best = t < best ? t : best;
+    }
+
+    printf("reading %ld integers from %s, best of %d\n", ints, filename, runs);
+    printf("  %10.3f ms %8.2f M ints/s %8.2f MB/s\n", best * 1e3,
+           ints / best / 1e6, bytes / best / 1e6);
+
+    free(input);
+    return 0;
+}
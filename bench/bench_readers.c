@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lispy.h"
+#include "bench.h"
+
+// The hand-written reader against mpc_parse followed by lval_read, on the
+// same input: a generated script of nested expressions over numbers,
+// decimals and symbols, or a file given after the run count.
+#define BENCH_FORMS 20000
+
+char *bench_symbols[] = {"list", "head", "tail", "join", "eval", "+", "-", "*", "x", "y1", "a-b"};
+
+void bench_write_expr(FILE *f, int depth)
+{
+    int kind = rand() % 8;
+
+    if (depth > 0 && kind < 3)
+    {
+        fputc(kind == 0 ? '{' : '(', f);
+        int n = rand() % 5;
+        for (int i = 0; i < n; i++)
+        {
+            if (i)
+                fputc(' ', f);
+            bench_write_expr(f, depth - 1);
+        }
+        fputc(kind == 0 ? '}' : ')', f);
+    }
+    else if (kind < 5)
+        fprintf(f, "%d", rand() % 20000 - 10000);
+    else if (kind < 6)
+        fprintf(f, "%d.%d", rand() % 1000, rand() % 100);
+    else
+        fputs(bench_symbols[rand() % (sizeof(bench_symbols) / sizeof(bench_symbols[0]))], f);
+}
+
+char *bench_script(long *len)
+{
+    char *buf;
+    size_t size;
+    FILE *f = open_memstream(&buf, &size);
+
+    srand(1);
+    for (int i = 0; i < BENCH_FORMS; i++)
+    {
+        fputc('(', f);
+        bench_write_expr(f, 4);
+        fputs(" 1)\n", f);
+    }
+
+    fclose(f);
+    *len = size;
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    int runs = argc > 1 ? atoi(argv[1]) : 5;
+
+    long len;
+    char *input = argc > 2 ? lval_slurp(argv[2], &len) : bench_script(&len);
+    if (!input)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    lgrammar g;
+    lgrammar_new(&g);
+
+    double hand = 1e30, mpc = 1e30;
+    int forms = 0;
+
+    for (int i = 0; i < runs; i++)
+    {
+        double t = bench_now();
+        lval *x = lval_read_str(input);
+        t = bench_now() - t;
+        hand = t < hand ? t : hand;
+
+        mpc_result_t r;
+        t = bench_now();
+        if (!mpc_parse("bench", input, g.lispy, &r))
+        {
+            mpc_err_print(r.error);
+            return 1;
+        }
+        lval *y = lval_read(r.output);
+        mpc_ast_delete(r.output);
+        t = bench_now() - t;
+        mpc = t < mpc ? t : mpc;
+
+        if (!x || x->count != y->count)
+        {
+            printf("the readers disagree\n");
+            return 1;
+        }
+
+        forms = x->count;
+        lval_del(x);
+        lval_del(y);
+    }
+
+    printf("reading %d forms, %ld bytes, best of %d\n", forms, len, runs);
+    printf("  hand-written %10.3f ms %8.2f MB/s\n", hand * 1e3, len / hand / 1e6);
+    printf("  mpc          %10.3f ms %8.2f MB/s\n", mpc * 1e3, len / mpc / 1e6);
+    printf("  speedup      %10.2fx\n", mpc / hand);
+
+    lgrammar_del(&g);
+    free(input);
+    return 0;
+}
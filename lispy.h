@@ -0,0 +1,184 @@
+#ifndef LISPY_H
+#define LISPY_H
+
+#include <stdint.h>
+#include <mpc.h>
+
+// The Lispy runtime, as used by my_lisp, by the C that lispyc generates and
+// by the benchmarks. It is all defined in main.c, which leaves out its own
+// main when built with LISPY_NO_MAIN.
+
+struct lval;
+struct lenv;
+typedef struct lval lval;
+typedef struct lenv lenv;
+
+enum
+{
+    LVAL_NUM,
+    LVAL_BIG,
+    LVAL_DBL,
+    LVAL_VEC,
+    LVAL_MAT,
+    LVAL_RANGE,
+    LVAL_ERR,
+    LVAL_SYM,
+    LVAL_FUN,
+    LVAL_SEXPR,
+    LVAL_QEXPR
+};
+
+typedef lval *(*lbuiltin)(lenv *, lval *);
+
+struct lval
+{
+    int type;
+
+    // S-expressions and Q-expressions: the count cells they hold
+    int count;
+    struct lval **cell;
+
+    // The value of every other type, in the fields of its own
+    union
+    {
+        long num;
+        double dbl;
+        char *err;
+        char *sym;
+        lbuiltin fun;
+
+        // Ranges: start, start + step, ... up to but not including stop
+        struct
+        {
+            long start;
+            long stop;
+            long step;
+        };
+
+        // The numbers of bignums, vectors and matrices are never changed
+        // once made, so copies share them. refs counts the lvals sharing
+        // them, and is NULL until the first copy.
+        struct
+        {
+            long *refs;
+
+            union
+            {
+                // Integers that do not fit in a long: sign and little-endian
+                // magnitude in base 2^32, with no leading zero limbs
+                struct
+                {
+                    int sign;
+                    int size;
+                    uint32_t *limbs;
+                };
+
+                // Packed numeric vectors: len elements in one buffer, either
+                // longs in ints or, for float vectors, doubles in dbls (ints
+                // is then NULL). Matrices: rows x cols doubles in dbls,
+                // stored row-major, with ints NULL.
+                struct
+                {
+                    union
+                    {
+                        long len;
+                        long rows;
+                    };
+                    long cols;
+                    long *ints;
+                    double *dbls;
+                };
+            };
+        };
+    };
+};
+
+struct lenv
+{
+    int count;
+    char **syms;
+    lval **vals;
+};
+
+lval *lval_num(long num);
+lval *lval_dbl(double dbl);
+lval *lval_big(int sign, uint32_t *limbs, int size);
+lval *lval_mat(long rows, long cols, double *dbls);
+lval *lval_range(long start, long stop, long step);
+lval *lval_err(char *fmt, ...);
+lval *lval_sym(char *sym);
+lval *lval_sexpr(void);
+lval *lval_qexpr(void);
+lval *lval_add(lval *v, lval *x);
+lval *lval_copy(lval *v);
+void lval_del(lval *v);
+void lval_print(lval *v);
+void lval_println(lval *v);
+
+lenv *lenv_new(void);
+void lenv_del(lenv *e);
+void lenv_add_builtins(lenv *e);
+
+lval *lval_eval(lenv *e, lval *v);
+lval *lval_apply(lenv *e, lval *v, lbuiltin fun);
+lval *lval_join(lval *x, lval *y);
+
+// The builtins lenv_add_builtins binds, by Lispy name and C name, ending
+// with a NULL name
+typedef struct
+{
+    char *name;
+    char *c_name;
+    lbuiltin fun;
+} lbuiltin_entry;
+
+extern lbuiltin_entry lbuiltins[];
+
+lval *builtin_list(lenv *e, lval *v);
+lval *builtin_head(lenv *e, lval *v);
+lval *builtin_tail(lenv *e, lval *v);
+lval *builtin_eval(lenv *e, lval *v);
+lval *builtin_join(lenv *e, lval *v);
+lval *builtin_add(lenv *e, lval *v);
+lval *builtin_sub(lenv *e, lval *v);
+lval *builtin_mul(lenv *e, lval *v);
+lval *builtin_div(lenv *e, lval *v);
+lval *builtin_pow(lenv *e, lval *v);
+lval *builtin_powmod(lenv *e, lval *v);
+lval *builtin_min(lenv *e, lval *v);
+lval *builtin_max(lenv *e, lval *v);
+lval *builtin_sum(lenv *e, lval *v);
+lval *builtin_product(lenv *e, lval *v);
+lval *builtin_vec(lenv *e, lval *v);
+lval *builtin_range(lenv *e, lval *v);
+lval *builtin_mat(lenv *e, lval *v);
+lval *builtin_matmul(lenv *e, lval *v);
+lval *builtin_def(lenv *e, lval *a);
+
+// The parsers of the Lispy grammar. lispy reads a whole input and form
+// one top-level form of a stream.
+typedef struct
+{
+    mpc_parser_t *integer;
+    mpc_parser_t *decimal;
+    mpc_parser_t *number;
+    mpc_parser_t *symbol;
+    mpc_parser_t *sexpr;
+    mpc_parser_t *qexpr;
+    mpc_parser_t *expr;
+    mpc_parser_t *lispy;
+    mpc_parser_t *form;
+} lgrammar;
+
+void lgrammar_new(lgrammar *g);
+void lgrammar_del(lgrammar *g);
+
+lval *lval_read(mpc_ast_t *t);
+lval *lval_read_str(char *s);
+lval *lval_parse(mpc_parser_t *lispy, char *filename, char *input);
+char *lval_slurp(char *filename, long *len);
+
+void lval_load_print(lval *x);
+int lval_load(lenv *e, mpc_parser_t *lispy, char *filename);
+
+#endif // LISPY_H
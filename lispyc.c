@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "lispy.h"
+
+// lispyc translates a Lispy script into C that runs it on the runtime in
+// main.c, so the program it is built into has no grammar to set up and
+// nothing to parse. Each top-level form becomes a function that builds its
+// value with lval_* calls. An S-expression headed by the name of a builtin
+// calls that builtin directly on its evaluated arguments, unless the script
+// may rebind the name; anything else goes through lval_apply, as it would
+// in the evaluator.
+
+// The names a script may rebind. A 'def' at the head of an S-expression
+// that is run, with a literal Q-expression of symbols, rebinds just those.
+// A 'def' anywhere else, such as quoted for a later 'eval', could rebind
+// any name.
+typedef struct
+{
+    int any;
+    int count;
+    char **syms;
+} lc_defs;
+
+void lc_defs_add(lc_defs *d, char *sym)
+{
+    d->syms = realloc(d->syms, sizeof(char *) * (d->count + 1));
+    d->syms[d->count++] = sym;
+}
+
+int lc_defs_has(lc_defs *d, char *sym)
+{
+    for (int i = 0; i < d->count; i++)
+    {
+        if (strcmp(d->syms[i], sym) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+int lc_is_def(lval *v)
+{
+    return v->type == LVAL_SYM && strcmp(v->sym, "def") == 0;
+}
+
+// Scans the list v, which is run when code is set and is data otherwise
+void lc_defs_scan(lc_defs *d, lval *v, int code)
+{
+    for (int i = 0; i < v->count; i++)
+    {
+        lval *c = v->cell[i];
+
+        if (lc_is_def(c))
+        {
+            lval *syms = v->count > 1 ? v->cell[1] : NULL;
+            int literal = code && i == 0 && syms && syms->type == LVAL_QEXPR;
+
+            for (int j = 0; literal && j < syms->count; j++)
+                literal = syms->cell[j]->type == LVAL_SYM;
+
+            if (!literal)
+            {
+                d->any = 1;
+                continue;
+            }
+
+            for (int j = 0; j < syms->count; j++)
+                lc_defs_add(d, syms->cell[j]->sym);
+        }
+
+        if (c->type == LVAL_SEXPR || c->type == LVAL_QEXPR)
+            lc_defs_scan(d, c, code && c->type == LVAL_SEXPR);
+    }
+}
+
+// The builtin an S-expression can call directly, or NULL
+lbuiltin_entry *lc_builtin(lc_defs *d, lval *v)
+{
+    if (d->any || v->count < 2 || v->cell[0]->type != LVAL_SYM)
+        return NULL;
+
+    for (lbuiltin_entry *b = lbuiltins; b->name; b++)
+    {
+        if (strcmp(b->name, v->cell[0]->sym) == 0)
+            return lc_defs_has(d, b->name) ? NULL : b;
+    }
+
+    return NULL;
+}
+
+int lc_has_big(lval *v)
+{
+    if (v->type == LVAL_BIG)
+        return 1;
+
+    for (int i = 0; (v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) && i < v->count; i++)
+    {
+        if (lc_has_big(v->cell[i]))
+            return 1;
+    }
+
+    return 0;
+}
+
+// Temporaries are numbered afresh in each form's function
+int lc_temp;
+
+void lc_emit_str(FILE *out, char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if (*s == '\\' || *s == '"')
+            fputc('\\', out);
+        fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+// Emits a declaration of a new temporary holding an atom, returning its
+// number
+int lc_emit_atom(FILE *out, lval *v)
+{
+    int t = lc_temp++;
+    fprintf(out, "    lval *t%d = ", t);
+
+    switch (v->type)
+    {
+    case LVAL_NUM:
+        if (v->num == LONG_MIN)
+            fprintf(out, "lval_num(LONG_MIN);\n");
+        else
+            fprintf(out, "lval_num(%ldL);\n", v->num);
+        break;
+    case LVAL_DBL:
+        fprintf(out, "lval_dbl(%a);\n", v->dbl);
+        break;
+    case LVAL_BIG:
+        fprintf(out, "lc_big(%d, %d, (uint32_t[]){", v->sign, v->size);
+        for (int i = 0; i < v->size; i++)
+            fprintf(out, "%s0x%08xu", i ? ", " : "", v->limbs[i]);
+        fprintf(out, "});\n");
+        break;
+    case LVAL_SYM:
+        fprintf(out, "lval_sym(");
+        lc_emit_str(out, v->sym);
+        fprintf(out, ");\n");
+        break;
+    }
+
+    return t;
+}
+
+// Emits statements building v as data, without evaluating it
+int lc_emit_quote(FILE *out, lval *v)
+{
+    if (v->type != LVAL_SEXPR && v->type != LVAL_QEXPR)
+        return lc_emit_atom(out, v);
+
+    int t = lc_temp++;
+    fprintf(out, "    lval *t%d = %s;\n", t, v->type == LVAL_SEXPR ? "lval_sexpr()" : "lval_qexpr()");
+
+    for (int i = 0; i < v->count; i++)
+    {
+        int x = lc_emit_quote(out, v->cell[i]);
+        fprintf(out, "    t%d = lval_add(t%d, t%d);\n", t, t, x);
+    }
+
+    return t;
+}
+
+// Emits statements evaluating v, in the order the evaluator would
+int lc_emit_eval(FILE *out, lc_defs *d, lval *v)
+{
+    if (v->type == LVAL_QEXPR)
+        return lc_emit_quote(out, v);
+
+    if (v->type != LVAL_SEXPR)
+    {
+        int t = lc_emit_atom(out, v);
+        if (v->type == LVAL_SYM)
+            fprintf(out, "    t%d = lval_eval(e, t%d);\n", t, t);
+        return t;
+    }
+
+    lbuiltin_entry *b = lc_builtin(d, v);
+
+    int t = lc_temp++;
+    fprintf(out, "    lval *t%d = lval_sexpr();\n", t);
+
+    for (int i = b ? 1 : 0; i < v->count; i++)
+    {
+        int x = lc_emit_eval(out, d, v->cell[i]);
+        fprintf(out, "    t%d = lval_add(t%d, t%d);\n", t, t, x);
+    }
+
+    fprintf(out, "    t%d = lval_apply(e, t%d, %s);\n", t, t, b ? b->c_name : "NULL");
+    return t;
+}
+
+void lc_emit_program(FILE *out, char *filename, lval *forms)
+{
+    lc_defs d = {0, 0, NULL};
+    for (int i = 0; i < forms->count; i++)
+    {
+        lval *f = forms->cell[i];
+        if (lc_is_def(f))
+            d.any = 1;
+        else if (f->type == LVAL_SEXPR || f->type == LVAL_QEXPR)
+            lc_defs_scan(&d, f, f->type == LVAL_SEXPR);
+    }
+
+    fprintf(out, "// Generated by lispyc from ");
+    lc_emit_str(out, filename);
+    fprintf(out, "\n\n#include <stdlib.h>\n#include <string.h>\n#include <limits.h>\n"
+                 "#include \"lispy.h\"\n\n");
+
+    if (lc_has_big(forms))
+        fprintf(out, "static lval *lc_big(int sign, int size, uint32_t *limbs)\n{\n"
+                     "    uint32_t *copy = malloc(sizeof(uint32_t) * size);\n"
+                     "    memcpy(copy, limbs, sizeof(uint32_t) * size);\n"
+                     "    return lval_big(sign, copy, size);\n}\n");
+
+    for (int i = 0; i < forms->count; i++)
+    {
+        lc_temp = 0;
+        fprintf(out, "\nstatic lval *lispy_form_%d(lenv *e)\n{\n", i);
+        int t = lc_emit_eval(out, &d, forms->cell[i]);
+        fprintf(out, "    return t%d;\n}\n", t);
+    }
+
+    fprintf(out, "\nint main(void)\n{\n    lenv *e = lenv_new();\n    lenv_add_builtins(e);\n\n");
+    for (int i = 0; i < forms->count; i++)
+        fprintf(out, "    lval_load_print(lispy_form_%d(e));\n", i);
+    fprintf(out, "\n    lenv_del(e);\n    return 0;\n}\n");
+
+    free(d.syms);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2 && argc != 3)
+    {
+        fprintf(stderr, "usage: lispyc script.lspy [out.c]\n");
+        return 2;
+    }
+
+    long len;
+    char *input = lval_slurp(argv[1], &len);
+    if (!input)
+    {
+        fprintf(stderr, "lispyc: cannot read %s\n", argv[1]);
+        return 1;
+    }
+    if ((long)strlen(input) < len)
+    {
+        fprintf(stderr, "lispyc: %s contains a NUL byte\n", argv[1]);
+        free(input);
+        return 1;
+    }
+
+    lgrammar g;
+    lgrammar_new(&g);
+    lval *forms = lval_parse(g.lispy, argv[1], input);
+    lgrammar_del(&g);
+    free(input);
+
+    if (!forms)
+        return 1;
+
+    FILE *out = argc == 3 ? fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "lispyc: cannot write %s\n", argv[2]);
+        lval_del(forms);
+        return 1;
+    }
+
+    lc_emit_program(out, argv[1], forms);
+
+    lval_del(forms);
+    return out != stdout && fclose(out) != 0;
+}
@@ -1,12 +1,19 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <mpc.h>
-
-#define LASSERT(args, cond, err) \
-    if (!(cond))                 \
-    {                            \
-        lval_del(args);          \
-        return lval_err(err);    \
+#include <stdint.h>
+#include <limits.h>
+#include "lispy.h"
+
+#ifdef LISPY_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define LASSERT(args, cond, fmt, ...)     \
+    if (!(cond))                          \
+    {                                     \
+        lval_del(args);                   \
+        return lval_err(fmt, ##__VA_ARGS__); \
     }
 
 #ifdef _WIN32
@@ -35,20 +42,44 @@ void add_history(char *unused) {}
 
 #endif // _WIN32
 
-long pow_l(long x, long y)
+// Raises x to y >= 0 by repeated squaring. Returns 0 if the result
+// overflows a long.
+int pow_l(long x, long y, long *res)
 {
-    if (y == 0)
+    long r = 1;
+
+    while (y > 0)
     {
-        return 1;
+        if ((y & 1) && __builtin_mul_overflow(r, x, &r))
+            return 0;
+
+        y >>= 1;
+
+        if (y > 0 && __builtin_mul_overflow(x, x, &x))
+            return 0;
     }
 
-    long res = x;
-    for (int i = 1; i < y; i++)
+    *res = r;
+    return 1;
+}
+
+// (x * y) mod m for 0 <= x, y < m without overflowing
+long mulmod_l(long x, long y, long m)
+{
+#ifdef __SIZEOF_INT128__
+    return (long)((unsigned __int128)x * (unsigned __int128)y % (unsigned __int128)m);
+#else
+    long r = 0;
+    while (y > 0)
     {
-        res *= res;
-    }
+        if (y & 1)
+            r = r >= m - x ? r - (m - x) : r + x;
 
-    return res;
+        x = x >= m - x ? x - (m - x) : x + x;
+        y >>= 1;
+    }
+    return r;
+#endif
 }
 
 long min_l(long x, long y)
@@ -71,60 +102,94 @@ long max_l(long x, long y)
     return y;
 }
 
-struct lval;
-struct lenv;
-typedef struct lval lval;
-typedef struct lenv lenv;
+lval *lval_num(long num)
+{
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_NUM;
+    v->num = num;
+    return v;
+}
 
-enum
+lval *lval_dbl(double dbl)
 {
-    LVAL_NUM,
-    LVAL_ERR,
-    LVAL_SYM,
-    LVAL_FUN,
-    LVAL_SEXPR,
-    LVAL_QEXPR
-};
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_DBL;
+    v->dbl = dbl;
+    return v;
+}
 
-typedef lval *(*lbuiltin)(lenv *, lval *);
+// Takes ownership of whichever of ints and dbls is non-NULL
+lval *lval_vec(long len, long *ints, double *dbls)
+{
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_VEC;
+    v->len = len;
+    v->ints = ints;
+    v->dbls = dbls;
+    v->refs = NULL;
+    return v;
+}
 
-struct lval
+// Takes ownership of dbls
+lval *lval_mat(long rows, long cols, double *dbls)
 {
-    int type;
-    long num;
-    char *err;
-    char *sym;
-    lbuiltin fun;
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_MAT;
+    v->rows = rows;
+    v->cols = cols;
+    v->ints = NULL;
+    v->dbls = dbls;
+    v->refs = NULL;
+    return v;
+}
 
-    int count;
-    struct lval **cell;
-};
+lval *lval_range(long start, long stop, long step)
+{
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_RANGE;
+    v->start = start;
+    v->stop = stop;
+    v->step = step;
+    return v;
+}
 
-struct lenv
+// Number of elements, which may not fit in a long
+unsigned long lval_range_len(lval *v)
 {
-    int count;
-    char **syms;
-    lval **vals;
-};
+    if (v->step > 0)
+    {
+        if (v->start >= v->stop)
+            return 0;
+        return ((unsigned long)v->stop - (unsigned long)v->start - 1) / v->step + 1;
+    }
 
-void lval_print(lval *v);
-lval *lval_eval(lenv *e, lval *v);
-lval *lval_join(lval *x, lval *y);
+    if (v->start <= v->stop)
+        return 0;
+    return ((unsigned long)v->start - (unsigned long)v->stop - 1) / (0 - (unsigned long)v->step) + 1;
+}
 
-lval *lval_num(long num)
+// Element i, for i below the length
+long lval_range_at(lval *v, unsigned long i)
 {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
-    v->num = num;
-    return v;
+    return (long)((unsigned long)v->start + i * (unsigned long)v->step);
 }
 
-lval *lval_err(char *err)
+lval *lval_err(char *fmt, ...)
 {
     lval *v = malloc(sizeof(lval));
     v->type = LVAL_ERR;
-    v->err = malloc(strlen(err) + 1);
-    strcpy(v->err, err);
+
+    va_list va;
+    va_start(va, fmt);
+    int n = vsnprintf(NULL, 0, fmt, va);
+    va_end(va);
+
+    v->err = malloc(n + 1);
+
+    va_start(va, fmt);
+    vsnprintf(v->err, n + 1, fmt, va);
+    va_end(va);
+
     return v;
 }
 
@@ -163,11 +228,55 @@ lval *lval_qexpr(void)
     return v;
 }
 
+// Shares the payload of a bignum, vector or matrix with a copy
+void lval_share(lval *x, lval *v)
+{
+    if (!v->refs)
+    {
+        v->refs = malloc(sizeof(long));
+        *v->refs = 1;
+    }
+
+    (*v->refs)++;
+    x->refs = v->refs;
+}
+
+// Drops a reference to the payload of a bignum, vector or matrix, returning
+// 1 when it was the last and the payload is to be freed
+int lval_unshare(lval *v)
+{
+    if (!v->refs)
+        return 1;
+
+    if (--*v->refs > 0)
+        return 0;
+
+    free(v->refs);
+    return 1;
+}
+
 void lval_del(lval *v)
 {
     switch (v->type)
     {
     case LVAL_NUM:
+    case LVAL_DBL:
+    case LVAL_RANGE:
+        break;
+    case LVAL_BIG:
+        if (lval_unshare(v))
+            free(v->limbs);
+        break;
+    case LVAL_VEC:
+        if (lval_unshare(v))
+        {
+            free(v->ints);
+            free(v->dbls);
+        }
+        break;
+    case LVAL_MAT:
+        if (lval_unshare(v))
+            free(v->dbls);
         break;
     case LVAL_ERR:
         free(v->err);
@@ -204,6 +313,20 @@ lval *lval_copy(lval *v)
     case LVAL_NUM:
         x->num = v->num;
         break;
+    case LVAL_DBL:
+        x->dbl = v->dbl;
+        break;
+    case LVAL_RANGE:
+        x->start = v->start;
+        x->stop = v->stop;
+        x->step = v->step;
+        break;
+    case LVAL_BIG:
+    case LVAL_VEC:
+    case LVAL_MAT:
+        *x = *v;
+        lval_share(x, v);
+        break;
     case LVAL_ERR:
         x->err = malloc(strlen(v->err) + 1);
         strcpy(x->err, v->err);
@@ -248,17 +371,27 @@ void lenv_del(lenv *e)
     free(e);
 }
 
-lval *lenv_get(lenv *e, lval *v)
+lval *lenv_lookup(lenv *e, char *sym)
 {
     for (int i = 0; i < e->count; i++)
     {
-        if (strcmp(e->syms[i], v->sym) == 0)
+        if (strcmp(e->syms[i], sym) == 0)
         {
-            return lval_copy(e->vals[i]);
+            return e->vals[i];
         }
     }
 
-    return lval_err("unbound symbol!");
+    return NULL;
+}
+
+// Returns a copy of the value bound to v. Bignums, vectors and matrices
+// share their numbers with the binding, so a lookup does not depend on
+// their size.
+lval *lenv_get(lenv *e, lval *v)
+{
+    lval *x = lenv_lookup(e, v->sym);
+
+    return x ? lval_copy(x) : lval_err("unbound symbol!");
 }
 
 void lenv_put(lenv *e, lval *k, lval *v)
@@ -291,280 +424,2574 @@ lval *lval_add(lval *v, lval *x)
     return v;
 }
 
-lval *lval_read_num(mpc_ast_t *t)
+int limbs_trim(uint32_t *a, int n)
 {
-    errno = 0;
-    long num = strtol(t->contents, NULL, 10);
+    while (n > 0 && a[n - 1] == 0)
+        n--;
 
-    return errno != ERANGE ? lval_num(num) : lval_err("invalid number");
+    return n;
 }
 
-lval *lval_read(mpc_ast_t *t)
+int limbs_cmp(uint32_t *a, int an, uint32_t *b, int bn)
 {
-    if (strstr(t->tag, "number"))
-        return lval_read_num(t);
-    if (strstr(t->tag, "symbol"))
-        return lval_sym(t->contents);
-
-    lval *v = NULL;
-    if (strcmp(t->tag, ">") == 0)
-        v = lval_sexpr();
-    if (strstr(t->tag, "sexpr"))
-        v = lval_sexpr();
-    if (strstr(t->tag, "qexpr"))
-        v = lval_qexpr();
+    if (an != bn)
+        return an < bn ? -1 : 1;
 
-    for (int i = 0; i < t->children_num; i++)
+    for (int i = an - 1; i >= 0; i--)
     {
-        if (strcmp(t->children[i]->contents, "(") == 0)
-            continue;
-        if (strcmp(t->children[i]->contents, ")") == 0)
-            continue;
-        if (strcmp(t->children[i]->contents, "{") == 0)
-            continue;
-        if (strcmp(t->children[i]->contents, "}") == 0)
-            continue;
-        if (strcmp(t->children[i]->tag, "regex") == 0)
-            continue;
-
-        v = lval_add(v, lval_read(t->children[i]));
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
     }
 
-    return v;
+    return 0;
 }
 
-void lval_expr_print(lval *v, char open, char close)
+// r must have room for max(an, bn) + 1 limbs
+int limbs_add(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    putchar(open);
+    if (an < bn)
+        return limbs_add(r, b, bn, a, an);
 
-    for (int i = 0; i < v->count; i++)
+    uint64_t carry = 0;
+    for (int i = 0; i < an; i++)
     {
-        lval_print(v->cell[i]);
-
-        if (i != (v->count - 1))
-            putchar(' ');
+        carry += (uint64_t)a[i] + (i < bn ? b[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
     }
 
-    putchar(close);
+    r[an] = (uint32_t)carry;
+    return limbs_trim(r, an + 1);
 }
 
-void lval_print(lval *v)
+// Requires a >= b; r must have room for an limbs
+int limbs_sub(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    switch (v->type)
+    int64_t borrow = 0;
+    for (int i = 0; i < an; i++)
     {
-    case LVAL_NUM:
-        printf("%li", v->num);
-        break;
-    case LVAL_ERR:
-        printf("Error: %s", v->err);
-        break;
-    case LVAL_SYM:
-        printf("%s", v->sym);
-        break;
-    case LVAL_FUN:
-        printf("<function>");
-        break;
-    case LVAL_SEXPR:
-        lval_expr_print(v, '(', ')');
-        break;
-    case LVAL_QEXPR:
-        lval_expr_print(v, '{', '}');
-        break;
+        int64_t t = (int64_t)a[i] - (i < bn ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = (uint32_t)t;
     }
+
+    return limbs_trim(r, an);
 }
 
-void lval_println(lval *v)
+// Below this many limbs in the shorter operand, schoolbook multiplication
+// beats Karatsuba's extra additions and allocations.
+#define KARATSUBA_THRESHOLD 32
+
+// r[0..rn) += x[0..xn), where r is known to be wide enough for the sum
+void limbs_add_into(uint32_t *r, int rn, uint32_t *x, int xn)
 {
-    lval_print(v);
-    putchar('\n');
+    uint64_t carry = 0;
+    for (int i = 0; i < rn && (i < xn || carry); i++)
+    {
+        carry += (uint64_t)r[i] + (i < xn ? x[i] : 0);
+        r[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
 }
 
-lval *lval_pop(lval *v, int i)
+// r[0..rn) -= x[0..xn), where r is known to be at least x
+void limbs_sub_into(uint32_t *r, int rn, uint32_t *x, int xn)
 {
-    lval *x = v->cell[i];
-    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
-    v->count--;
-    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
-
-    return x;
+    int64_t borrow = 0;
+    for (int i = 0; i < rn && (i < xn || borrow); i++)
+    {
+        int64_t t = (int64_t)r[i] - (i < xn ? x[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = (uint32_t)t;
+    }
 }
 
-lval *lval_take(lval *v, int i)
+// Writes all an + bn limbs of the product to r, which must not alias a or b
+void limbs_mul_school(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    lval *x = lval_pop(v, i);
-    lval_del(v);
+    memset(r, 0, sizeof(uint32_t) * (an + bn));
 
-    return x;
+    for (int i = 0; i < an; i++)
+    {
+        uint64_t carry = 0;
+        for (int j = 0; j < bn; j++)
+        {
+            carry += (uint64_t)a[i] * b[j] + r[i + j];
+            r[i + j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        r[i + bn] = (uint32_t)carry;
+    }
 }
 
-lval *builtin_op(lenv *e, lval *v, char *op)
+// Same contract as limbs_mul_school. Splits both operands at m limbs and
+// gets by with three half-size products: a0*b0, a1*b1 and
+// (a0 + a1)(b0 + b1), from which the middle term is recovered.
+void limbs_mul_karatsuba(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    for (int i = 0; i < v->count; i++)
+    if (an < bn)
     {
-        if (v->cell[i]->type != LVAL_NUM)
-        {
-            lval_del(v);
-            return lval_err("Cannot operate on non-number!");
-        }
+        limbs_mul_karatsuba(r, b, bn, a, an);
+        return;
     }
 
-    lval *x = lval_pop(v, 0);
+    if (bn < KARATSUBA_THRESHOLD)
+    {
+        limbs_mul_school(r, a, an, b, bn);
+        return;
+    }
 
-    if ((strcmp(op, "-") == 0) && v->count == 0)
-        x->num = -x->num;
+    int m = (an + 1) / 2;
 
-    while (v->count > 0)
+    // Too lopsided to split b; multiply it by each half of a instead
+    if (bn <= m)
     {
-        lval *y = lval_pop(v, 0);
+        uint32_t *t = malloc(sizeof(uint32_t) * (an - m + bn));
 
-        if (strcmp(op, "+") == 0)
-            x->num += y->num;
-        if (strcmp(op, "-") == 0)
-            x->num -= y->num;
-        if (strcmp(op, "*") == 0)
-            x->num *= y->num;
-        if (strcmp(op, "/") == 0 || strcmp(op, "%") == 0)
-        {
-            if (y->num == 0)
-            {
-                lval_del(x);
-                lval_del(y);
-                x = lval_err("Division By Zero!");
-                break;
-            }
+        limbs_mul_karatsuba(r, a, m, b, bn);
+        memset(r + m + bn, 0, sizeof(uint32_t) * (an - m));
+        limbs_mul_karatsuba(t, a + m, an - m, b, bn);
+        limbs_add_into(r + m, an + bn - m, t, an - m + bn);
 
-            if (strcmp(op, "/") == 0)
-                x->num /= y->num;
+        free(t);
+        return;
+    }
 
-            if (strcmp(op, "%") == 0)
-                x->num = x->num % y->num;
-        }
+    uint32_t *sa = malloc(sizeof(uint32_t) * (m + 1));
+    uint32_t *sb = malloc(sizeof(uint32_t) * (m + 1));
+    uint32_t *z1 = malloc(sizeof(uint32_t) * (2 * m + 2));
 
-        lval_del(y);
-    }
+    memcpy(sa, a, sizeof(uint32_t) * m);
+    sa[m] = 0;
+    limbs_add_into(sa, m + 1, a + m, an - m);
 
-    lval_del(v);
-    return x;
-}
+    memcpy(sb, b, sizeof(uint32_t) * m);
+    sb[m] = 0;
+    limbs_add_into(sb, m + 1, b + m, bn - m);
 
-lval *builtin_add(lenv *e, lval *v)
-{
-    return builtin_op(e, v, "+");
-}
+    limbs_mul_karatsuba(r, a, m, b, m);
+    limbs_mul_karatsuba(r + 2 * m, a + m, an - m, b + m, bn - m);
+    limbs_mul_karatsuba(z1, sa, m + 1, sb, m + 1);
 
-lval *builtin_sub(lenv *e, lval *v)
-{
-    return builtin_op(e, v, "-");
-}
+    limbs_sub_into(z1, 2 * m + 2, r, 2 * m);
+    limbs_sub_into(z1, 2 * m + 2, r + 2 * m, an + bn - 2 * m);
+    limbs_add_into(r + m, an + bn - m, z1, 2 * m + 2);
 
-lval *builtin_mul(lenv *e, lval *v)
-{
-    return builtin_op(e, v, "*");
+    free(sa);
+    free(sb);
+    free(z1);
 }
 
-lval *builtin_div(lenv *e, lval *v)
+// r must have room for an + bn limbs and must not alias a or b
+int limbs_mul(uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    return builtin_op(e, v, "/");
+    limbs_mul_karatsuba(r, a, an, b, bn);
+    return limbs_trim(r, an + bn);
 }
 
-lval *builtin_head(lenv *e, lval *v)
+// Knuth's algorithm D. Requires an >= bn >= 1 and a trimmed b; q gets
+// an - bn + 1 limbs and r gets bn limbs.
+void limbs_divmod(uint32_t *q, uint32_t *r, uint32_t *a, int an, uint32_t *b, int bn)
 {
-    LASSERT(v, v->count == 1,
-            "Function 'head' called with wrong number of arguments");
-    LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-            "Function 'head' called with wrong type");
-    LASSERT(v, v->cell[0]->count != 0,
-            "Function 'head' called with empty {}");
-
-    lval *head = lval_take(v, 0);
-
-    while (head->count > 1)
+    if (bn == 1)
     {
-        lval_del(lval_pop(head, 1));
+        uint64_t rem = 0;
+        for (int i = an - 1; i >= 0; i--)
+        {
+            uint64_t cur = (rem << 32) | a[i];
+            q[i] = (uint32_t)(cur / b[0]);
+            rem = cur % b[0];
+        }
+
+        r[0] = (uint32_t)rem;
+        return;
     }
 
-    return head;
-}
+    int s = __builtin_clz(b[bn - 1]);
+    uint32_t *vn = malloc(sizeof(uint32_t) * bn);
+    uint32_t *un = malloc(sizeof(uint32_t) * (an + 1));
 
-lval *builtin_tail(lenv *e, lval *v)
-{
-    LASSERT(v, v->count == 1,
-            "Function 'tail' called with wrong number of arguments");
-    LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-            "Function 'tail' called with wrong type");
-    LASSERT(v, v->cell[0]->count != 0,
-            "Function 'tail' called with empty {}");
+    for (int i = bn - 1; i > 0; i--)
+        vn[i] = (b[i] << s) | (uint32_t)((uint64_t)b[i - 1] >> (32 - s));
+    vn[0] = b[0] << s;
 
-    lval *tail = lval_take(v, 0);
+    un[an] = (uint32_t)((uint64_t)a[an - 1] >> (32 - s));
+    for (int i = an - 1; i > 0; i--)
+        un[i] = (a[i] << s) | (uint32_t)((uint64_t)a[i - 1] >> (32 - s));
+    un[0] = a[0] << s;
 
-    lval_del(lval_pop(tail, 0));
-    return tail;
-}
+    for (int j = an - bn; j >= 0; j--)
+    {
+        uint64_t num = ((uint64_t)un[j + bn] << 32) | un[j + bn - 1];
+        uint64_t qhat = num / vn[bn - 1];
+        uint64_t rhat = num % vn[bn - 1];
 
-lval *builtin_list(lenv *e, lval *v)
-{
-    v->type = LVAL_QEXPR;
-    return v;
-}
+        while (qhat >> 32 || qhat * vn[bn - 2] > ((rhat << 32) | un[j + bn - 2]))
+        {
+            qhat--;
+            rhat += vn[bn - 1];
+            if (rhat >> 32)
+                break;
+        }
 
-lval *builtin_eval(lenv *e, lval *v)
-{
-    LASSERT(v, v->count == 1,
-            "Function 'eval' called with wrong number of arguments");
-    LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-            "Function 'eval' called with wrong type");
+        int64_t k = 0, t;
+        for (int i = 0; i < bn; i++)
+        {
+            uint64_t p = qhat * vn[i];
+            t = (int64_t)un[i + j] - k - (int64_t)(p & 0xFFFFFFFF);
+            un[i + j] = (uint32_t)t;
+            k = (int64_t)(p >> 32) - (t >> 32);
+        }
+        t = (int64_t)un[j + bn] - k;
+        un[j + bn] = (uint32_t)t;
 
-    lval *vv = lval_take(v, 0);
-    vv->type = LVAL_SEXPR;
+        q[j] = (uint32_t)qhat;
+        if (t < 0)
+        {
+            q[j]--;
+            uint64_t carry = 0;
+            for (int i = 0; i < bn; i++)
+            {
+                carry += (uint64_t)un[i + j] + vn[i];
+                un[i + j] = (uint32_t)carry;
+                carry >>= 32;
+            }
+            un[j + bn] += (uint32_t)carry;
+        }
+    }
 
-    return lval_eval(e, vv);
+    for (int i = 0; i < bn - 1; i++)
+        r[i] = (un[i] >> s) | (uint32_t)((uint64_t)un[i + 1] << (32 - s));
+    r[bn - 1] = un[bn - 1] >> s;
+
+    free(vn);
+    free(un);
 }
 
-lval *builtin_join(lenv *e, lval *v)
+// Takes ownership of limbs. Values that fit in a long come back as
+// LVAL_NUM, so LVAL_BIG only ever holds integers outside that range.
+lval *lval_big(int sign, uint32_t *limbs, int size)
 {
-    for (int i = 0; i < v->count; i++)
+    size = limbs_trim(limbs, size);
+
+    if (size <= 2)
     {
-        LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
-                "Function 'join' called with wrong type");
-    }
+        unsigned long long m = size > 0 ? limbs[0] : 0;
+        if (size == 2)
+            m |= (unsigned long long)limbs[1] << 32;
 
-    lval *vv = lval_pop(v, 0);
+        if (sign > 0 && m <= LONG_MAX)
+        {
+            free(limbs);
+            return lval_num((long)m);
+        }
 
-    while (v->count)
-    {
-        vv = lval_join(vv, lval_pop(v, 0));
+        if (sign < 0 && m <= (unsigned long long)LONG_MAX + 1)
+        {
+            free(limbs);
+            return lval_num(m == (unsigned long long)LONG_MAX + 1 ? LONG_MIN : -(long)m);
+        }
     }
 
-    lval_del(v);
-    return vv;
+    lval *v = malloc(sizeof(lval));
+    v->type = LVAL_BIG;
+    v->sign = sign;
+    v->size = size;
+    v->limbs = limbs;
+    v->refs = NULL;
+    return v;
 }
 
-lval *lval_join(lval *x, lval *y)
+// Views any integer lval as a sign and magnitude. buf backs the magnitude
+// of an LVAL_NUM and must hold two limbs.
+int lval_limbs(lval *v, uint32_t *buf, uint32_t **limbs, int *sign)
 {
-    while (y->count)
+    if (v->type == LVAL_BIG)
     {
-        x = lval_add(x, lval_pop(y, 0));
+        *limbs = v->limbs;
+        *sign = v->sign;
+        return v->size;
     }
 
-    lval_del(y);
-    return x;
+    unsigned long long m = v->num < 0 ? 0ULL - (unsigned long long)v->num
+                                      : (unsigned long long)v->num;
+    buf[0] = (uint32_t)m;
+    buf[1] = (uint32_t)(m >> 32);
+
+    *limbs = buf;
+    *sign = v->num < 0 ? -1 : 1;
+    return limbs_trim(buf, 2);
 }
 
-lval *builtin_def(lenv *e, lval *a)
+// Applies op to two integers of either representation. The divisor of
+// '/' and '%' must be non-zero; quotients truncate like C's.
+lval *lval_big_op(lval *x, lval *y, char op)
 {
-    LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
-            "Function 'def' called with wrong type");
+    uint32_t xbuf[2], ybuf[2];
+    uint32_t *a, *b;
+    int sa, sb;
+    int an = lval_limbs(x, xbuf, &a, &sa);
+    int bn = lval_limbs(y, ybuf, &b, &sb);
 
-    lval *syms = a->cell[0];
-
-    for (int i = 0; i < syms->count; i++)
+    if (op == '-')
     {
-        LASSERT(a, syms->cell[i]->type == LVAL_SYM,
-                "Function 'def' cannot define non-symbol")
+        sb = -sb;
+        op = '+';
     }
 
-    LASSERT(a, syms->count == a->count - 1,
-            "Function 'def' cannot define incorrect number of values to symbols");
+    if (op == '+')
+    {
+        int n = an > bn ? an : bn;
+        uint32_t *r = malloc(sizeof(uint32_t) * (n + 1));
+        if (!r)
+            return lval_err("Out of memory");
+
+        if (sa == sb)
+            return lval_big(sa, r, limbs_add(r, a, an, b, bn));
+
+        if (limbs_cmp(a, an, b, bn) >= 0)
+            return lval_big(sa, r, limbs_sub(r, a, an, b, bn));
+
+        return lval_big(sb, r, limbs_sub(r, b, bn, a, an));
+    }
+
+    if (op == '*')
+    {
+        uint32_t *r = malloc(sizeof(uint32_t) * (an + bn + 1));
+        if (!r)
+            return lval_err("Out of memory");
+
+        return lval_big(sa * sb, r, limbs_mul(r, a, an, b, bn));
+    }
+
+    if (limbs_cmp(a, an, b, bn) < 0)
+    {
+        if (op == '/')
+            return lval_num(0);
+
+        return lval_copy(x);
+    }
+
+    uint32_t *q = malloc(sizeof(uint32_t) * (an - bn + 1));
+    uint32_t *r = malloc(sizeof(uint32_t) * bn);
+    if (!q || !r)
+    {
+        free(q);
+        free(r);
+        return lval_err("Out of memory");
+    }
+
+    limbs_divmod(q, r, a, an, b, bn);
+
+    if (op == '/')
+    {
+        free(r);
+        return lval_big(sa * sb, q, an - bn + 1);
+    }
+
+    free(q);
+    return lval_big(sa, r, bn);
+}
+
+lval *lval_big_read(char *s)
+{
+    int sign = 1;
+    if (*s == '-')
+    {
+        sign = -1;
+        s++;
+    }
+
+    int len = strlen(s);
+    uint32_t *limbs = calloc(len / 9 + 2, sizeof(uint32_t));
+    int size = 0;
+
+    // Feed the digits in through chunks of up to nine, the most that
+    // still fit in a single limb.
+    for (int i = 0; i < len;)
+    {
+        uint32_t chunk = 0, scale = 1;
+        for (int j = 0; j < 9 && i < len; j++, i++)
+        {
+            chunk = chunk * 10 + (s[i] - '0');
+            scale *= 10;
+        }
+
+        uint64_t carry = chunk;
+        for (int j = 0; j < size; j++)
+        {
+            carry += (uint64_t)limbs[j] * scale;
+            limbs[j] = (uint32_t)carry;
+            carry >>= 32;
+        }
+        if (carry)
+            limbs[size++] = (uint32_t)carry;
+    }
+
+    return lval_big(sign, limbs, size);
+}
+
+// Two ASCII digits for every value below 100
+const char digit_pairs[] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Writes the digits of m two at a time, backwards so they end just before
+// end, and returns where they start
+char *fmt_ul(char *end, unsigned long m)
+{
+    char *p = end;
+
+    while (m >= 100)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + m % 100 * 2, 2);
+        m /= 100;
+    }
+
+    if (m >= 10)
+    {
+        p -= 2;
+        memcpy(p, digit_pairs + m * 2, 2);
+    }
+    else
+    {
+        *--p = '0' + m;
+    }
+
+    return p;
+}
+
+void lval_num_print(long x)
+{
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = fmt_ul(end, x < 0 ? 0 - (unsigned long)x : (unsigned long)x);
+
+    if (x < 0)
+        *--p = '-';
+
+    fwrite(p, 1, end - p, stdout);
+}
+
+// Renders the magnitude into one buffer nine digits at a time, each pass
+// dividing the whole number by 10^9, and writes it out with one call
+void lval_big_print(lval *v)
+{
+    int n = v->size;
+    uint32_t *a = malloc(sizeof(uint32_t) * n);
+    memcpy(a, v->limbs, sizeof(uint32_t) * n);
+
+    // Each limb holds fewer than ten digits
+    size_t cap = (size_t)n * 10 + 2;
+    char *buf = malloc(cap);
+    char *p = buf + cap;
+
+    while (n > 0)
+    {
+        uint64_t rem = 0;
+        for (int i = n - 1; i >= 0; i--)
+        {
+            uint64_t cur = (rem << 32) | a[i];
+            a[i] = (uint32_t)(cur / 1000000000);
+            rem = cur % 1000000000;
+        }
+
+        n = limbs_trim(a, n);
+
+        // Zero-pad every chunk but the leading one
+        if (n > 0)
+        {
+            for (int j = 0; j < 4; j++)
+            {
+                p -= 2;
+                memcpy(p, digit_pairs + rem % 100 * 2, 2);
+                rem /= 100;
+            }
+            *--p = '0' + rem;
+        }
+        else
+        {
+            p = fmt_ul(p, rem);
+        }
+    }
+
+    if (v->sign < 0)
+        *--p = '-';
+
+    fwrite(p, 1, buf + cap - p, stdout);
+
+    free(buf);
+    free(a);
+}
+
+double lval_to_dbl(lval *v)
+{
+    if (v->type == LVAL_DBL)
+        return v->dbl;
+    if (v->type == LVAL_NUM)
+        return (double)v->num;
+
+    double d = 0;
+    for (int i = v->size - 1; i >= 0; i--)
+        d = d * 4294967296.0 + v->limbs[i];
+
+    return v->sign * d;
+}
+
+// Every power of ten a double holds exactly
+const double pow10_exact[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Prints the shortest decimal that reads back as the same double, keeping
+// a decimal point so the result still reads as one.
+//
+// Where %g would print fixed notation, the fast path looks for the fewest
+// fraction digits k for which some m / 10^k, with m below 2^53, converts
+// back to d. Both m and 10^k are exact doubles, so the division rounds
+// exactly as reading the literal back would. Everything else falls back
+// to the shortest of %.15g, %.16g and %.17g that round-trips.
+void lval_dbl_print(double d)
+{
+    double a = fabs(d);
+    char buf[48];
+
+    if (a == 0 || (a >= 1e-4 && a < 1e15))
+    {
+        for (int k = 0; k < 23 && a * pow10_exact[k] < 9007199254740992.0; k++)
+        {
+            // The scaled value can be a rounding step off the true one
+            double m = nearbyint(a * pow10_exact[k]);
+            double tries[3] = {m, m - 1, m + 1};
+
+            for (int t = 0; t < 3; t++)
+            {
+                if (tries[t] < 0 || tries[t] / pow10_exact[k] != a)
+                    continue;
+
+                char *end = buf + sizeof(buf);
+                char *p = fmt_ul(end, (unsigned long)tries[t]);
+                while (end - p <= k)
+                    *--p = '0';
+
+                long whole = end - p - k;
+                if (signbit(d))
+                    putchar('-');
+                fwrite(p, 1, whole, stdout);
+                putchar('.');
+                if (k == 0)
+                    putchar('0');
+                else
+                    fwrite(p + whole, 1, k, stdout);
+                return;
+            }
+        }
+    }
+
+    for (int prec = 15; prec <= 17; prec++)
+    {
+        snprintf(buf, sizeof(buf), "%.*g", prec, d);
+        if (strtod(buf, NULL) == d)
+            break;
+    }
+
+    fputs(buf, stdout);
+    if (!strpbrk(buf, ".eni"))
+        fputs(".0", stdout);
+}
+
+// Reads eight bytes as one word, lowest address in the lowest byte
+uint64_t load8_le(char *s)
+{
+    uint64_t w;
+    memcpy(&w, s, sizeof(w));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+
+// Whether all eight bytes of w are ASCII digits
+int swar_digits8(uint64_t w)
+{
+    return ((w & 0xF0F0F0F0F0F0F0F0) |
+            (((w + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+// Value of eight ASCII digits, combining neighbouring digits, then pairs,
+// then quads in three multiplies instead of eight
+uint32_t swar_parse8(uint64_t w)
+{
+    w -= 0x3030303030303030;
+    w = (w * 10) + (w >> 8);
+    w = (((w & 0x000000FF000000FF) * (100 + (1000000ULL << 32))) +
+         (((w >> 16) & 0x000000FF000000FF) * (1 + (10000ULL << 32)))) >> 32;
+    return (uint32_t)w;
+}
+
+// Parses an optionally signed decimal integer into a long, eight digits at
+// a time. Returns 0 when s is not one or it does not fit in a long.
+int parse_l(char *s, long *out)
+{
+    int neg = *s == '-';
+    s += neg;
+
+    while (*s == '0' && s[1] != '\0')
+        s++;
+
+    size_t len = strlen(s);
+
+    // Nineteen digits always fit in a uint64_t, so the range check against
+    // LONG_MAX can wait until the end
+    if (len == 0 || len > 19)
+        return 0;
+
+    uint64_t m = 0;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8)
+    {
+        uint64_t w = load8_le(s + i);
+        if (!swar_digits8(w))
+            return 0;
+        m = m * 100000000 + swar_parse8(w);
+    }
+
+    for (; i < len; i++)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return 0;
+        m = m * 10 + (s[i] - '0');
+    }
+
+    if (m > (uint64_t)LONG_MAX + neg)
+        return 0;
+
+    *out = neg ? (long)(0 - m) : (long)m;
+    return 1;
+}
+
+// Tag IDs of the grammar rules lval_read tells apart, looked up in lgrammar_new
+typedef struct
+{
+    int expr;
+    int number;
+    int decimal;
+    int symbol;
+    int qexpr;
+} lread_tags;
+
+lread_tags ltags;
+
+lval *lval_read_num(mpc_ast_t *t)
+{
+    if (mpc_ast_tagged(t, ltags.decimal))
+        return lval_dbl(strtod(t->contents, NULL));
+
+    long num;
+    return parse_l(t->contents, &num) ? lval_num(num) : lval_big_read(t->contents);
+}
+
+// Leaf contents are slices of the parsed text, so like lread_token this
+// NUL-terminates them in place for as long as the conversion takes
+lval *lval_read_leaf(mpc_ast_t *t)
+{
+    char c = t->contents[t->contents_len];
+    t->contents[t->contents_len] = '\0';
+
+    lval *v = mpc_ast_tagged(t, ltags.number) ? lval_read_num(t) : lval_sym(t->contents);
+
+    t->contents[t->contents_len] = c;
+    return v;
+}
+
+lval *lval_read(mpc_ast_t *t)
+{
+    if (mpc_ast_tagged(t, ltags.number) || mpc_ast_tagged(t, ltags.symbol))
+        return lval_read_leaf(t);
+
+    // Everything else is the root, an sexpr or a qexpr, and the children
+    // worth reading are the ones that are expressions rather than
+    // brackets or the anchors around the input
+    lval *v = mpc_ast_tagged(t, ltags.qexpr) ? lval_qexpr() : lval_sexpr();
+
+    for (int i = 0; i < t->children_num; i++)
+    {
+        mpc_ast_t *c = t->children[i];
+        if (mpc_ast_tagged(c, ltags.expr))
+            v = lval_add(v, lval_read(c));
+    }
+
+    return v;
+}
+
+// A reader for the Lispy grammar that builds lvals as it scans, with no
+// mpc_ast_t in between. It accepts exactly what the grammar in main does:
+// whitespace after every token, numbers tried before symbols, and each
+// token as long as it will go.
+typedef struct
+{
+    char *s;
+    long pos;
+} lreader;
+
+int lread_is_space(char c)
+{
+    return c == ' ' || c == '\f' || c == '\n' || c == '\r' || c == '\t' || c == '\v';
+}
+
+int lread_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+int lread_is_symbol(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || lread_is_digit(c) ||
+           (c != '\0' && strchr("_+-*/\\=<>!&^", c) != NULL);
+}
+
+void lread_skip_space(lreader *r)
+{
+    while (lread_is_space(r->s[r->pos]))
+        r->pos++;
+}
+
+// Reads the token in [start, end), NUL-terminating it in place for as long
+// as the conversion takes
+lval *lread_token(lreader *r, long start, long end, int type)
+{
+    char *s = r->s + start;
+    char c = r->s[end];
+    r->s[end] = '\0';
+
+    lval *v;
+    long num;
+    if (type == LVAL_DBL)
+        v = lval_dbl(strtod(s, NULL));
+    else if (type == LVAL_NUM)
+        v = parse_l(s, &num) ? lval_num(num) : lval_big_read(s);
+    else
+        v = lval_sym(s);
+
+    r->s[end] = c;
+    r->pos = end;
+    lread_skip_space(r);
+    return v;
+}
+
+lval *lread_expr(lreader *r);
+
+// Reads expressions into v up to the closing bracket, or to the end of
+// the input when close is '\0'
+lval *lread_list(lreader *r, lval *v, char close)
+{
+    while (r->s[r->pos] != close)
+    {
+        lval *x = lread_expr(r);
+        if (!x)
+        {
+            lval_del(v);
+            return NULL;
+        }
+        lval_add(v, x);
+    }
+
+    if (close != '\0')
+    {
+        r->pos++;
+        lread_skip_space(r);
+    }
+
+    return v;
+}
+
+// Returns NULL at anything the grammar would reject
+lval *lread_expr(lreader *r)
+{
+    char *s = r->s;
+    long start = r->pos;
+    long i = start + (s[start] == '-');
+
+    if (lread_is_digit(s[i]))
+    {
+        while (lread_is_digit(s[i]))
+            i++;
+
+        if (s[i] == '.' && lread_is_digit(s[i + 1]))
+        {
+            i++;
+            while (lread_is_digit(s[i]))
+                i++;
+            return lread_token(r, start, i, LVAL_DBL);
+        }
+
+        return lread_token(r, start, i, LVAL_NUM);
+    }
+
+    if (lread_is_symbol(s[start]))
+    {
+        i = start;
+        while (lread_is_symbol(s[i]))
+            i++;
+        return lread_token(r, start, i, LVAL_SYM);
+    }
+
+    if (s[start] == '(' || s[start] == '{')
+    {
+        r->pos++;
+        lread_skip_space(r);
+        return s[start] == '('
+                   ? lread_list(r, lval_sexpr(), ')')
+                   : lread_list(r, lval_qexpr(), '}');
+    }
+
+    return NULL;
+}
+
+// Reads a whole input into an S-expression of its forms, or returns NULL
+// if it is not valid Lispy
+lval *lval_read_str(char *s)
+{
+    lreader r = {s, 0};
+    lread_skip_space(&r);
+    return lread_list(&r, lval_sexpr(), '\0');
+}
+
+// Reads the tree of a successful mpc parse, or prints the error of a failed
+// one and returns NULL
+lval *lval_read_result(int ok, mpc_result_t *r)
+{
+    if (!ok)
+    {
+        mpc_err_print(r->error);
+        mpc_err_delete(r->error);
+        return NULL;
+    }
+
+    lval *x = lval_read(r->output);
+    mpc_ast_delete(r->output);
+    return x;
+}
+
+// Reads an input with the hand-written reader. Anything it rejects goes
+// through the mpc grammar instead, so syntax errors are reported by mpc,
+// with its positions and wording. Returns NULL after printing the error.
+lval *lval_parse(mpc_parser_t *lispy, char *filename, char *input)
+{
+#ifndef LISPY_MPC_READER
+    lval *v = lval_read_str(input);
+    if (v)
+        return v;
+#endif
+
+    mpc_result_t r;
+    return lval_read_result(mpc_parse(filename, input, lispy, &r), &r);
+}
+
+void lgrammar_new(lgrammar *g)
+{
+    g->integer = mpc_new("integer");
+    g->decimal = mpc_new("decimal");
+    g->number = mpc_new("number");
+    g->symbol = mpc_new("symbol");
+    g->sexpr = mpc_new("sexpr");
+    g->qexpr = mpc_new("qexpr");
+    g->expr = mpc_new("expr");
+    g->lispy = mpc_new("lispy");
+    g->form = mpc_new("form");
+
+    ltags = (lread_tags){
+        mpc_tag_id("expr"), mpc_tag_id("number"), mpc_tag_id("decimal"),
+        mpc_tag_id("symbol"), mpc_tag_id("qexpr"),
+    };
+
+    mpca_lang(MPCA_LANG_PACKRAT | MPCA_LANG_SLICES,
+              "\
+            integer : /-?\\d+/ ; \
+            decimal : /-?\\d+\\.\\d+/ ; \
+            number :  <decimal> | <integer> ; \
+            symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^]+/ ; \
+            sexpr : '(' <expr>* ')' ; \
+            qexpr : '{' <expr>* '}' ; \
+            expr : <number> | <symbol> | <sexpr> | <qexpr> ; \
+            lispy : /^/ <expr>* /$/ ; \
+            form : /\\s*/ (<expr> | /$/) ; \
+          ",
+              g->integer, g->decimal, g->number, g->symbol, g->sexpr, g->qexpr, g->expr,
+              g->lispy, g->form);
+}
+
+void lgrammar_del(lgrammar *g)
+{
+    mpc_cleanup(9, g->integer, g->decimal, g->number, g->symbol, g->sexpr, g->qexpr, g->expr,
+                g->lispy, g->form);
+}
+
+void lval_expr_print(lval *v, char open, char close)
+{
+    putchar(open);
+
+    for (int i = 0; i < v->count; i++)
+    {
+        lval_print(v->cell[i]);
+
+        if (i != (v->count - 1))
+            putchar(' ');
+    }
+
+    putchar(close);
+}
+
+// Prints straight from the packed buffer, in the same form as a Q-expr
+void lval_vec_print(lval *v)
+{
+    putchar('{');
+
+    for (long i = 0; i < v->len; i++)
+    {
+        if (v->ints)
+            lval_num_print(v->ints[i]);
+        else
+            lval_dbl_print(v->dbls[i]);
+
+        if (i != v->len - 1)
+            putchar(' ');
+    }
+
+    putchar('}');
+}
+
+void lval_mat_print(lval *v)
+{
+    putchar('{');
+
+    for (long i = 0; i < v->rows; i++)
+    {
+        putchar('{');
+
+        for (long j = 0; j < v->cols; j++)
+        {
+            lval_dbl_print(v->dbls[i * v->cols + j]);
+
+            if (j != v->cols - 1)
+                putchar(' ');
+        }
+
+        putchar('}');
+
+        if (i != v->rows - 1)
+            putchar(' ');
+    }
+
+    putchar('}');
+}
+
+// Prints each element as it is generated, in the same form as a Q-expr
+void lval_range_print(lval *v)
+{
+    unsigned long n = lval_range_len(v);
+    putchar('{');
+
+    for (unsigned long i = 0; i < n; i++)
+    {
+        lval_num_print(lval_range_at(v, i));
+
+        if (i != n - 1)
+            putchar(' ');
+    }
+
+    putchar('}');
+}
+
+void lval_print(lval *v)
+{
+    switch (v->type)
+    {
+    case LVAL_NUM:
+        lval_num_print(v->num);
+        break;
+    case LVAL_BIG:
+        lval_big_print(v);
+        break;
+    case LVAL_DBL:
+        lval_dbl_print(v->dbl);
+        break;
+    case LVAL_VEC:
+        lval_vec_print(v);
+        break;
+    case LVAL_MAT:
+        lval_mat_print(v);
+        break;
+    case LVAL_RANGE:
+        lval_range_print(v);
+        break;
+    case LVAL_ERR:
+        printf("Error: %s", v->err);
+        break;
+    case LVAL_SYM:
+        printf("%s", v->sym);
+        break;
+    case LVAL_FUN:
+        printf("<function>");
+        break;
+    case LVAL_SEXPR:
+        lval_expr_print(v, '(', ')');
+        break;
+    case LVAL_QEXPR:
+        lval_expr_print(v, '{', '}');
+        break;
+    }
+}
+
+void lval_println(lval *v)
+{
+    lval_print(v);
+    putchar('\n');
+}
+
+lval *lval_pop(lval *v, int i)
+{
+    lval *x = v->cell[i];
+    memmove(&v->cell[i], &v->cell[i + 1], sizeof(lval *) * (v->count - i - 1));
+    v->count--;
+    v->cell = realloc(v->cell, sizeof(lval *) * v->count);
+
+    return x;
+}
+
+lval *lval_take(lval *v, int i)
+{
+    lval *x = lval_pop(v, i);
+    lval_del(v);
+
+    return x;
+}
+
+// Runs fn over [0, n) split into contiguous ranges, one per thread of a
+// pool that is started on first use and then kept for the life of the
+// process. Without LISPY_THREADS, or for fewer than two grains of work,
+// it is a plain call on the whole range.
+typedef void (*lpar_fn)(void *ctx, long begin, long end);
+
+#ifdef LISPY_THREADS
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    long size;
+    unsigned long generation;
+    long pending;
+
+    lpar_fn fn;
+    void *ctx;
+    long n;
+    long parts;
+} lpar_pool;
+
+lpar_pool lpar = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+pthread_once_t lpar_once = PTHREAD_ONCE_INIT;
+
+// Worker w runs part w of every job; parts past the job's count sit it out
+void *lpar_worker(void *arg)
+{
+    long w = (long)arg;
+    unsigned long seen = 0;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&lpar.lock);
+        while (lpar.generation == seen)
+            pthread_cond_wait(&lpar.wake, &lpar.lock);
+        seen = lpar.generation;
+        lpar_fn fn = lpar.fn;
+        void *ctx = lpar.ctx;
+        long n = lpar.n;
+        long parts = lpar.parts;
+        pthread_mutex_unlock(&lpar.lock);
+
+        if (w < parts)
+            fn(ctx, n * w / parts, n * (w + 1) / parts);
+
+        pthread_mutex_lock(&lpar.lock);
+        if (--lpar.pending == 0)
+            pthread_cond_signal(&lpar.done);
+        pthread_mutex_unlock(&lpar.lock);
+    }
+
+    return NULL;
+}
+
+void lpar_start(void)
+{
+    long cpus = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    // Workers are numbered from 1; the calling thread is part 0
+    for (long w = 1; w < cpus; w++)
+    {
+        pthread_t id;
+        if (pthread_create(&id, NULL, lpar_worker, (void *)w) != 0)
+            break;
+        pthread_detach(id);
+        lpar.size++;
+    }
+}
+#endif
+
+void lpar_for(long n, long grain, lpar_fn fn, void *ctx)
+{
+    long threads = 1;
+#ifdef LISPY_THREADS
+    pthread_once(&lpar_once, lpar_start);
+    threads = lpar.size + 1;
+#endif
+    if (threads > n / grain)
+        threads = n / grain;
+
+    if (threads < 2)
+    {
+        fn(ctx, 0, n);
+        return;
+    }
+
+#ifdef LISPY_THREADS
+    pthread_mutex_lock(&lpar.lock);
+    lpar.fn = fn;
+    lpar.ctx = ctx;
+    lpar.n = n;
+    lpar.parts = threads;
+    lpar.pending = lpar.size;
+    lpar.generation++;
+    pthread_cond_broadcast(&lpar.wake);
+    pthread_mutex_unlock(&lpar.lock);
+
+    fn(ctx, 0, n / threads);
+
+    pthread_mutex_lock(&lpar.lock);
+    while (lpar.pending != 0)
+        pthread_cond_wait(&lpar.done, &lpar.lock);
+    pthread_mutex_unlock(&lpar.lock);
+#endif
+}
+
+// Vector kernels are cloned for AVX2, SSE4.2 and baseline x86-64, and the
+// loader picks the best one the CPU supports when the program starts.
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__linux__)
+#define LVEC_KERNEL __attribute__((target_clones("avx2", "sse4.2", "default")))
+#else
+#define LVEC_KERNEL
+#endif
+
+// a[i] = a[i] op b[i]
+LVEC_KERNEL void lvec_dbl_op(double *a, double *b, long n, char op)
+{
+    switch (op)
+    {
+    case '+':
+        for (long i = 0; i < n; i++)
+            a[i] += b[i];
+        break;
+    case '-':
+        for (long i = 0; i < n; i++)
+            a[i] -= b[i];
+        break;
+    case '*':
+        for (long i = 0; i < n; i++)
+            a[i] *= b[i];
+        break;
+    case '/':
+        for (long i = 0; i < n; i++)
+            a[i] /= b[i];
+        break;
+    case '%':
+        for (long i = 0; i < n; i++)
+            a[i] = fmod(a[i], b[i]);
+        break;
+    }
+}
+
+// a[i] = a[i] op b[i]. Returns 0 if any element overflowed and -1 on a
+// zero divisor. Sums and differences are computed wrapping, with the
+// overflow test folded into a flag so that the loops still vectorize.
+LVEC_KERNEL int lvec_int_op(long *a, long *b, long n, char op)
+{
+    unsigned long ovf = 0;
+
+    switch (op)
+    {
+    case '+':
+        for (long i = 0; i < n; i++)
+        {
+            long r = (long)((unsigned long)a[i] + (unsigned long)b[i]);
+            ovf |= (unsigned long)((a[i] ^ r) & (b[i] ^ r));
+            a[i] = r;
+        }
+        break;
+    case '-':
+        for (long i = 0; i < n; i++)
+        {
+            long r = (long)((unsigned long)a[i] - (unsigned long)b[i]);
+            ovf |= (unsigned long)((a[i] ^ b[i]) & (a[i] ^ r));
+            a[i] = r;
+        }
+        break;
+    case '*':
+        for (long i = 0; i < n; i++)
+        {
+            if (__builtin_mul_overflow(a[i], b[i], &a[i]))
+                return 0;
+        }
+        break;
+    case '/':
+    case '%':
+        for (long i = 0; i < n; i++)
+        {
+            if (b[i] == 0)
+                return -1;
+            if (b[i] == -1 && a[i] == LONG_MIN)
+            {
+                if (op == '/')
+                    return 0;
+                a[i] = 0;
+                continue;
+            }
+            a[i] = op == '/' ? a[i] / b[i] : a[i] % b[i];
+        }
+        break;
+    }
+
+    return (long)ovf >= 0;
+}
+
+LVEC_KERNEL long lvec_int_min(long *a, long n)
+{
+    long m = a[0];
+    for (long i = 1; i < n; i++)
+        m = a[i] < m ? a[i] : m;
+    return m;
+}
+
+LVEC_KERNEL long lvec_int_max(long *a, long n)
+{
+    long m = a[0];
+    for (long i = 1; i < n; i++)
+        m = a[i] > m ? a[i] : m;
+    return m;
+}
+
+// Sums the high and low halves of every element separately, which cannot
+// overflow, so the exact total is hi * 2^(half the bits of a long) + lo
+LVEC_KERNEL void lvec_int_sum(long *a, long n, int64_t *hi, uint64_t *lo)
+{
+    int half = sizeof(long) * 4;
+    int64_t h = 0;
+    uint64_t l = 0;
+
+    for (long i = 0; i < n; i++)
+    {
+        h += a[i] >> half;
+        l += (unsigned long)a[i] & ((1UL << half) - 1);
+    }
+
+    *hi = h;
+    *lo = l;
+}
+
+lval *lval_int64(int64_t x)
+{
+    uint64_t m = x < 0 ? 0 - (uint64_t)x : (uint64_t)x;
+    uint32_t *limbs = malloc(sizeof(uint32_t) * 2);
+    limbs[0] = (uint32_t)m;
+    limbs[1] = (uint32_t)(m >> 32);
+    return lval_big(x < 0 ? -1 : 1, limbs, 2);
+}
+
+// Tile sizes for matmul: a BK x BJ panel of b (256 KiB) stays in L2 while
+// BI rows of a stream past it
+#define MATMUL_BI 64
+#define MATMUL_BK 128
+#define MATMUL_BJ 256
+
+typedef struct
+{
+    double *a;
+    double *b;
+    double *c;
+    long k;
+    long m;
+} lmat_mul_ctx;
+
+// c[i][j] += a[i][p] * b[p][j] over one tile; the j loop is unit-stride
+// in both b and c, which is what the vectorizer wants
+LVEC_KERNEL void lmat_mul_tile(double *restrict c, double *restrict a, double *restrict b,
+                               long k, long m, long i0, long i1, long p0, long p1, long j0, long j1)
+{
+    for (long i = i0; i < i1; i++)
+    {
+        for (long p = p0; p < p1; p++)
+        {
+            double x = a[i * k + p];
+            double *restrict bp = b + p * m;
+            double *restrict ci = c + i * m;
+
+            for (long j = j0; j < j1; j++)
+                ci[j] += x * bp[j];
+        }
+    }
+}
+
+// Multiplies the row panel [begin, end) of a into c
+void lmat_mul_rows(void *arg, long begin, long end)
+{
+    lmat_mul_ctx *ctx = arg;
+
+    for (long i0 = begin; i0 < end; i0 += MATMUL_BI)
+    {
+        long i1 = i0 + MATMUL_BI < end ? i0 + MATMUL_BI : end;
+
+        for (long p0 = 0; p0 < ctx->k; p0 += MATMUL_BK)
+        {
+            long p1 = p0 + MATMUL_BK < ctx->k ? p0 + MATMUL_BK : ctx->k;
+
+            for (long j0 = 0; j0 < ctx->m; j0 += MATMUL_BJ)
+            {
+                long j1 = j0 + MATMUL_BJ < ctx->m ? j0 + MATMUL_BJ : ctx->m;
+                lmat_mul_tile(ctx->c, ctx->a, ctx->b, ctx->k, ctx->m, i0, i1, p0, p1, j0, j1);
+            }
+        }
+    }
+}
+
+// Elements of a vector, or a scalar broadcast to n elements, in a new buffer
+double *lvec_to_dbls(lval *x, long n)
+{
+    double *d = malloc(sizeof(double) * n);
+
+    for (long i = 0; i < n; i++)
+    {
+        if (x->type != LVAL_VEC)
+            d[i] = lval_to_dbl(x);
+        else
+            d[i] = x->ints ? (double)x->ints[i] : x->dbls[i];
+    }
+
+    return d;
+}
+
+long *lvec_to_ints(lval *x, long n)
+{
+    long *d = malloc(sizeof(long) * n);
+
+    if (x->type == LVAL_VEC)
+    {
+        memcpy(d, x->ints, sizeof(long) * n);
+    }
+    else
+    {
+        for (long i = 0; i < n; i++)
+            d[i] = x->num;
+    }
+
+    return d;
+}
+
+// Element-wise op between two operands, at least one of them a vector.
+// Integer vectors stay integer unless a double joins in; they do not
+// promote to bignums, so overflowing an element is an error.
+lval *lvec_op(lval *x, lval *y, char op)
+{
+    if (x->type == LVAL_BIG || y->type == LVAL_BIG)
+        return lval_err("Cannot mix bignums with vectors!");
+
+    if (x->type == LVAL_VEC && y->type == LVAL_VEC && x->len != y->len)
+        return lval_err("Vector lengths do not match!");
+
+    long n = x->type == LVAL_VEC ? x->len : y->len;
+
+    if ((x->type == LVAL_VEC && x->dbls) || (y->type == LVAL_VEC && y->dbls) ||
+        x->type == LVAL_DBL || y->type == LVAL_DBL)
+    {
+        double *a = lvec_to_dbls(x, n);
+        double *b = lvec_to_dbls(y, n);
+
+        // Fail like the scalar path rather than divide into inf and NaN
+        for (long i = 0; (op == '/' || op == '%') && i < n; i++)
+        {
+            if (b[i] == 0)
+            {
+                free(a);
+                free(b);
+                return lval_err("Division By Zero!");
+            }
+        }
+
+        lvec_dbl_op(a, b, n, op);
+        free(b);
+        return lval_vec(n, NULL, a);
+    }
+
+    long *a = lvec_to_ints(x, n);
+    long *b = lvec_to_ints(y, n);
+    int ok = lvec_int_op(a, b, n, op);
+    free(b);
+
+    if (ok <= 0)
+    {
+        free(a);
+        return lval_err(ok < 0 ? "Division By Zero!" : "Integer overflow in vector!");
+    }
+
+    return lval_vec(n, a, NULL);
+}
+
+// Reduces elements [begin, end) of a vector with sum ('+'), product ('*'),
+// min ('<') or max ('>')
+lval *lvec_reduce_range(lval *v, long begin, long end, char op)
+{
+    long n = end - begin;
+
+    if (v->dbls)
+    {
+        double *d = v->dbls + begin;
+        double acc = op == '*' ? 1 : op == '+' ? 0 : d[0];
+        for (long i = 0; i < n; i++)
+        {
+            switch (op)
+            {
+            case '+':
+                acc += d[i];
+                break;
+            case '*':
+                acc *= d[i];
+                break;
+            case '<':
+                acc = d[i] < acc ? d[i] : acc;
+                break;
+            case '>':
+                acc = d[i] > acc ? d[i] : acc;
+                break;
+            }
+        }
+        return lval_dbl(acc);
+    }
+
+    long *a = v->ints + begin;
+
+    if (op == '<')
+        return lval_num(lvec_int_min(a, n));
+    if (op == '>')
+        return lval_num(lvec_int_max(a, n));
+
+    if (op == '+')
+    {
+        int64_t hi;
+        uint64_t lo;
+        lvec_int_sum(a, n, &hi, &lo);
+
+        uint32_t *limbs = malloc(sizeof(uint32_t) * 2);
+        limbs[0] = (uint32_t)lo;
+        limbs[1] = (uint32_t)(lo >> 32);
+
+        lval *h = lval_int64(hi);
+        lval *shift = lval_int64((int64_t)1 << (sizeof(long) * 4));
+        lval *l = lval_big(1, limbs, 2);
+
+        lval *t = lval_big_op(h, shift, '*');
+        lval *r = lval_big_op(t, l, '+');
+        lval_del(h);
+        lval_del(shift);
+        lval_del(l);
+        lval_del(t);
+        return r;
+    }
+
+    long acc = 1, r;
+    long i = 0;
+    for (; i < n; i++)
+    {
+        if (__builtin_mul_overflow(acc, a[i], &r))
+            break;
+        acc = r;
+    }
+
+    // Overflowed: finish the product in bignums from where it stopped
+    lval *x = lval_num(acc);
+    for (; i < n; i++)
+    {
+        lval *y = lval_num(a[i]);
+        lval *r = lval_big_op(x, y, '*');
+        lval_del(x);
+        lval_del(y);
+        x = r;
+    }
+
+    return x;
+}
+
+// Reductions cut a vector into chunks of a fixed size, whatever the number
+// of threads, and combine the per-chunk results in order. Integer results
+// are exact anyway; this also makes float sums the same on every machine.
+#define LVEC_CHUNK (1L << 16)
+
+// Fewest chunks worth handing to each thread
+#define LVEC_CHUNK_GRAIN 4
+
+typedef struct
+{
+    lval *v;
+    char op;
+    lval **parts;
+} lvec_reduce_ctx;
+
+void lvec_reduce_chunks(void *arg, long begin, long end)
+{
+    lvec_reduce_ctx *ctx = arg;
+
+    for (long c = begin; c < end; c++)
+    {
+        long lo = c * LVEC_CHUNK;
+        long hi = lo + LVEC_CHUNK < ctx->v->len ? lo + LVEC_CHUNK : ctx->v->len;
+        ctx->parts[c] = lvec_reduce_range(ctx->v, lo, hi, ctx->op);
+    }
+}
+
+// Reduces a vector with sum ('+'), product ('*'), min ('<') or max ('>');
+// min and max expect a non-empty vector
+lval *lvec_reduce(lval *v, char op)
+{
+    if (v->len == 0)
+        return lval_num(op == '*' ? 1 : 0);
+
+    long chunks = (v->len + LVEC_CHUNK - 1) / LVEC_CHUNK;
+
+    lvec_reduce_ctx ctx;
+    ctx.v = v;
+    ctx.op = op;
+    ctx.parts = malloc(sizeof(lval *) * chunks);
+    lpar_for(chunks, LVEC_CHUNK_GRAIN, lvec_reduce_chunks, &ctx);
+
+    lval *x = ctx.parts[0];
+
+    for (long c = 1; c < chunks; c++)
+    {
+        lval *y = ctx.parts[c];
+
+        if (op == '<' || op == '>')
+        {
+            int less = v->dbls ? y->dbl < x->dbl : y->num < x->num;
+            int more = v->dbls ? y->dbl > x->dbl : y->num > x->num;
+
+            if (op == '<' ? less : more)
+            {
+                lval *t = x;
+                x = y;
+                y = t;
+            }
+
+            lval_del(y);
+            continue;
+        }
+
+        lval *r;
+        if (v->dbls)
+            r = lval_dbl(op == '*' ? x->dbl * y->dbl : x->dbl + y->dbl);
+        else
+            r = lval_big_op(x, y, op);
+
+        lval_del(x);
+        lval_del(y);
+        x = r;
+    }
+
+    free(ctx.parts);
+    return x;
+}
+
+// Reduces a range with sum ('+'), product ('*'), min ('<') or max ('>')
+// without generating it, except for products; min and max expect a
+// non-empty range
+lval *lval_range_reduce(lval *v, char op)
+{
+    unsigned long n = lval_range_len(v);
+
+    if (n == 0)
+        return lval_num(op == '*' ? 1 : 0);
+
+    long first = v->start;
+    long last = lval_range_at(v, n - 1);
+
+    if (op == '<')
+        return lval_num(v->step > 0 ? first : last);
+    if (op == '>')
+        return lval_num(v->step > 0 ? last : first);
+
+    if (op == '+')
+    {
+        // n * (first + last) / 2, where the product is always even
+        uint32_t *limbs = malloc(sizeof(uint32_t) * 2);
+        limbs[0] = (uint32_t)n;
+        limbs[1] = (uint32_t)((uint64_t)n >> 32);
+
+        lval *count = lval_big(1, limbs, 2);
+        lval *a = lval_num(first);
+        lval *b = lval_num(last);
+        lval *two = lval_num(2);
+
+        lval *ends = lval_big_op(a, b, '+');
+        lval *t = lval_big_op(count, ends, '*');
+        lval *r = lval_big_op(t, two, '/');
+        lval_del(count);
+        lval_del(a);
+        lval_del(b);
+        lval_del(two);
+        lval_del(ends);
+        lval_del(t);
+        return r;
+    }
+
+    // Stepping over zero makes the product zero however long the range is
+    long lo = first < last ? first : last;
+    long hi = first < last ? last : first;
+    unsigned long dist = first < 0 ? 0 - (unsigned long)first : (unsigned long)first;
+    unsigned long stride = v->step > 0 ? (unsigned long)v->step : 0 - (unsigned long)v->step;
+    if (lo <= 0 && hi >= 0 && dist % stride == 0)
+        return lval_num(0);
+
+    long acc = 1, r;
+    unsigned long i = 0;
+    for (; i < n; i++)
+    {
+        if (__builtin_mul_overflow(acc, lval_range_at(v, i), &r))
+            break;
+        acc = r;
+    }
+
+    lval *x = lval_num(acc);
+    for (; i < n; i++)
+    {
+        lval *y = lval_num(lval_range_at(v, i));
+        lval *r = lval_big_op(x, y, '*');
+        lval_del(x);
+        lval_del(y);
+        x = r;
+    }
+
+    return x;
+}
+
+// Applies op to two longs, reporting overflow (or, for '/', LONG_MIN / -1)
+// by returning 0 and leaving x untouched.
+int lval_num_op(long *x, long y, char op)
+{
+    long r;
+
+    switch (op)
+    {
+    case '+':
+        if (__builtin_add_overflow(*x, y, &r))
+            return 0;
+        break;
+    case '-':
+        if (__builtin_sub_overflow(*x, y, &r))
+            return 0;
+        break;
+    case '*':
+        if (__builtin_mul_overflow(*x, y, &r))
+            return 0;
+        break;
+    case '/':
+        if (y == -1)
+            return lval_num_op(x, -1, '*');
+        r = *x / y;
+        break;
+    case '%':
+        r = y == -1 ? 0 : *x % y;
+        break;
+    default:
+        return 0;
+    }
+
+    *x = r;
+    return 1;
+}
+
+lval *builtin_op(lenv *e, lval *v, char *op)
+{
+    for (int i = 0; i < v->count; i++)
+    {
+        int type = v->cell[i]->type;
+        if (type != LVAL_NUM && type != LVAL_BIG && type != LVAL_DBL && type != LVAL_VEC)
+        {
+            lval_del(v);
+            return lval_err("Cannot operate on non-number!");
+        }
+    }
+
+    // Every operator is a single character, so resolve it once up front.
+    // Operands are folded as plain longs until a result overflows or a
+    // bignum operand turns up, and only then through lval_big_op. Once a
+    // double is involved the rest of the fold happens in doubles, and once
+    // a vector is involved it is element-wise.
+    char o = op[0];
+    lval *x = lval_pop(v, 0);
+
+    if (o == '-' && v->count == 0)
+    {
+        if (x->type == LVAL_VEC)
+        {
+            lval *zero = lval_num(0);
+            lval *r = lvec_op(zero, x, '-');
+            lval_del(zero);
+            lval_del(x);
+            x = r;
+        }
+        else if (x->type == LVAL_DBL)
+        {
+            x->dbl = -x->dbl;
+        }
+        else if (x->type == LVAL_NUM && x->num != LONG_MIN)
+        {
+            x->num = -x->num;
+        }
+        else
+        {
+            lval *zero = lval_num(0);
+            lval *r = lval_big_op(zero, x, '-');
+            lval_del(zero);
+            lval_del(x);
+            x = r;
+        }
+    }
+
+    for (int i = 0; i < v->count && x->type != LVAL_ERR; i++)
+    {
+        lval *y = v->cell[i];
+
+        if (x->type == LVAL_VEC || y->type == LVAL_VEC)
+        {
+            lval *r = lvec_op(x, y, o);
+            lval_del(x);
+            x = r;
+            continue;
+        }
+
+        if ((o == '/' || o == '%') &&
+            ((y->type == LVAL_NUM && y->num == 0) || (y->type == LVAL_DBL && y->dbl == 0)))
+        {
+            lval_del(x);
+            lval_del(v);
+            return lval_err("Division By Zero!");
+        }
+
+        if (x->type == LVAL_NUM && y->type == LVAL_NUM && lval_num_op(&x->num, y->num, o))
+            continue;
+
+        if (x->type == LVAL_DBL || y->type == LVAL_DBL)
+        {
+            double a = lval_to_dbl(x), b = lval_to_dbl(y);
+            lval_del(x);
+
+            switch (o)
+            {
+            case '+':
+                x = lval_dbl(a + b);
+                break;
+            case '-':
+                x = lval_dbl(a - b);
+                break;
+            case '*':
+                x = lval_dbl(a * b);
+                break;
+            case '/':
+                x = lval_dbl(a / b);
+                break;
+            case '%':
+                x = lval_dbl(fmod(a, b));
+                break;
+            }
+            continue;
+        }
+
+        lval *r = lval_big_op(x, y, o);
+        lval_del(x);
+        x = r;
+    }
+
+    lval_del(v);
+    return x;
+}
+
+lval *builtin_add(lenv *e, lval *v)
+{
+    return builtin_op(e, v, "+");
+}
+
+lval *builtin_sub(lenv *e, lval *v)
+{
+    return builtin_op(e, v, "-");
+}
+
+lval *builtin_mul(lenv *e, lval *v)
+{
+    return builtin_op(e, v, "*");
+}
+
+lval *builtin_div(lenv *e, lval *v)
+{
+    return builtin_op(e, v, "/");
+}
+
+int lval_is_int(lval *v)
+{
+    return v->type == LVAL_NUM || v->type == LVAL_BIG;
+}
+
+int lval_is_neg(lval *v)
+{
+    return v->type == LVAL_BIG ? v->sign < 0 : v->num < 0;
+}
+
+// x mod |m| in [0, |m|), for integers of either representation
+lval *lval_mod(lval *x, lval *m)
+{
+    lval *r = lval_big_op(x, m, '%');
+
+    if (lval_is_neg(r))
+    {
+        lval *t = lval_is_neg(m) ? lval_big_op(r, m, '-') : lval_big_op(r, m, '+');
+        lval_del(r);
+        r = t;
+    }
+
+    return r;
+}
+
+// 'pow' refuses a result sure to have more bits than this, about 1.26
+// million decimal digits, before computing any of it
+#define LPOW_MAX_BITS (1L << 22)
+
+// The number of bits in the magnitude of an integer
+long lval_bits(lval *v)
+{
+    uint32_t buf[2];
+    uint32_t *limbs;
+    int sign;
+    int size = lval_limbs(v, buf, &limbs, &sign);
+
+    if (size == 0)
+        return 0;
+
+    return 32L * (size - 1) + 32 - __builtin_clz(limbs[size - 1]);
+}
+
+// Integer power for a non-negative long exponent, promoting to a bignum
+// once the running product leaves the range of a long. The result of a
+// base of k bits has between (k - 1) * n + 1 and k * n bits, and is an
+// error when even the fewer is more than LPOW_MAX_BITS.
+lval *lval_pow(lval *b, long n)
+{
+    long r;
+    if (b->type == LVAL_NUM && pow_l(b->num, n, &r))
+        return lval_num(r);
+
+    long bits = lval_bits(b);
+    if (bits > 1 && n > (LPOW_MAX_BITS - 1) / (bits - 1))
+        return lval_err("Function 'pow' result would have more than %ld bits", LPOW_MAX_BITS);
+
+    lval *res = lval_num(1);
+    lval *sq = lval_copy(b);
+
+    while (n > 0)
+    {
+        lval *t;
+        if (n & 1)
+        {
+            t = lval_big_op(res, sq, '*');
+            lval_del(res);
+            res = t;
+        }
+
+        n >>= 1;
+
+        if (n > 0 && res->type != LVAL_ERR)
+        {
+            t = lval_big_op(sq, sq, '*');
+            lval_del(sq);
+            sq = t;
+        }
+
+        // Out of memory part way: give up with the error
+        if (res->type == LVAL_ERR || sq->type == LVAL_ERR)
+        {
+            lval *err = res->type == LVAL_ERR ? res : sq;
+            lval_del(err == res ? sq : res);
+            return err;
+        }
+    }
+
+    lval_del(sq);
+    return res;
+}
+
+lval *builtin_pow(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 2,
+            "Function 'pow' called with wrong number of arguments");
+
+    lval *b = v->cell[0];
+    lval *n = v->cell[1];
+
+    LASSERT(v, (lval_is_int(b) || b->type == LVAL_DBL) &&
+                   (lval_is_int(n) || n->type == LVAL_DBL),
+            "Function 'pow' called with wrong type");
+
+    if (b->type == LVAL_DBL || n->type == LVAL_DBL)
+    {
+        lval *x = lval_dbl(pow(lval_to_dbl(b), lval_to_dbl(n)));
+        lval_del(v);
+        return x;
+    }
+
+    LASSERT(v, !lval_is_neg(n),
+            "Function 'pow' called with negative exponent");
+
+    // Only 0, 1 and -1 can be raised to an exponent that needs a bignum
+    if (n->type == LVAL_BIG)
+    {
+        LASSERT(v, b->type == LVAL_NUM && b->num >= -1 && b->num <= 1,
+                "Function 'pow' called with exponent too large");
+
+        lval *x = lval_num(b->num == -1 && (n->limbs[0] & 1) == 0 ? 1 : b->num);
+        lval_del(v);
+        return x;
+    }
+
+    lval *x = lval_pow(b, n->num);
+    lval_del(v);
+    return x;
+}
+
+// Modular exponentiation over bignums: scans the exponent's bits from the
+// top, squaring and reducing at every step
+lval *lval_powmod_big(lval *b, lval *n, lval *m)
+{
+    uint32_t buf[2];
+    uint32_t *limbs;
+    int sign;
+    int size = lval_limbs(n, buf, &limbs, &sign);
+
+    lval *one = lval_num(1);
+    lval *base = lval_mod(b, m);
+    lval *res = lval_mod(one, m);
+    lval_del(one);
+
+    for (int i = size - 1; i >= 0; i--)
+    {
+        for (int bit = 31; bit >= 0; bit--)
+        {
+            lval *t = lval_big_op(res, res, '*');
+            lval_del(res);
+            res = lval_mod(t, m);
+            lval_del(t);
+
+            if ((limbs[i] >> bit) & 1)
+            {
+                t = lval_big_op(res, base, '*');
+                lval_del(res);
+                res = lval_mod(t, m);
+                lval_del(t);
+            }
+        }
+    }
+
+    lval_del(base);
+    return res;
+}
+
+lval *builtin_powmod(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 3,
+            "Function 'powmod' called with wrong number of arguments");
+    LASSERT(v, lval_is_int(v->cell[0]) && lval_is_int(v->cell[1]) && lval_is_int(v->cell[2]),
+            "Function 'powmod' called with wrong type");
+    LASSERT(v, !lval_is_neg(v->cell[1]),
+            "Function 'powmod' called with negative exponent");
+    LASSERT(v, v->cell[2]->type == LVAL_BIG || v->cell[2]->num != 0,
+            "Function 'powmod' called with zero modulus");
+
+    lval *b = v->cell[0];
+    lval *n = v->cell[1];
+    lval *m = v->cell[2];
+
+    // Everything fits in a long: square and multiply without allocating
+    if (b->type == LVAL_NUM && n->type == LVAL_NUM &&
+        m->type == LVAL_NUM && m->num != LONG_MIN)
+    {
+        long mod = m->num < 0 ? -m->num : m->num;
+        long x = b->num % mod;
+        long y = n->num;
+        long r = 1 % mod;
+
+        if (x < 0)
+            x += mod;
+
+        while (y > 0)
+        {
+            if (y & 1)
+                r = mulmod_l(r, x, mod);
+
+            y >>= 1;
+            x = mulmod_l(x, x, mod);
+        }
+
+        lval_del(v);
+        return lval_num(r);
+    }
+
+    lval *x = lval_powmod_big(b, n, m);
+    lval_del(v);
+    return x;
+}
+
+// Orders two numbers of any representation
+int lval_num_cmp(lval *x, lval *y)
+{
+    if (x->type == LVAL_NUM && y->type == LVAL_NUM)
+        return (x->num > y->num) - (x->num < y->num);
+
+    if (x->type == LVAL_DBL || y->type == LVAL_DBL)
+    {
+        double a = lval_to_dbl(x), b = lval_to_dbl(y);
+        return (a > b) - (a < b);
+    }
+
+    uint32_t xbuf[2], ybuf[2];
+    uint32_t *a, *b;
+    int sa, sb;
+    int an = lval_limbs(x, xbuf, &a, &sa);
+    int bn = lval_limbs(y, ybuf, &b, &sb);
+
+    if (an == 0)
+        sa = 0;
+    if (bn == 0)
+        sb = 0;
+    if (sa != sb)
+        return sa < sb ? -1 : 1;
+
+    return sa * limbs_cmp(a, an, b, bn);
+}
+
+lval *builtin_extreme(lenv *e, lval *v, char *func)
+{
+    LASSERT(v, v->count == 1,
+            "Function '%s' called with wrong number of arguments", func);
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_VEC ||
+                   v->cell[0]->type == LVAL_RANGE,
+            "Function '%s' called with wrong type", func);
+
+    lval *q = v->cell[0];
+    int max = strcmp(func, "max") == 0;
+
+    if (q->type == LVAL_RANGE)
+    {
+        LASSERT(v, lval_range_len(q) != 0,
+                "Function '%s' called with empty {}", func);
+
+        lval *x = lval_range_reduce(q, max ? '>' : '<');
+        lval_del(v);
+        return x;
+    }
+
+    if (q->type == LVAL_VEC)
+    {
+        LASSERT(v, q->len != 0,
+                "Function '%s' called with empty {}", func);
+
+        lval *x = lvec_reduce(q, max ? '>' : '<');
+        lval_del(v);
+        return x;
+    }
+
+    LASSERT(v, q->count != 0,
+            "Function '%s' called with empty {}", func);
+
+    int fixnums = 1;
+
+    for (int i = 0; i < q->count; i++)
+    {
+        int type = q->cell[i]->type;
+        LASSERT(v, type == LVAL_NUM || type == LVAL_BIG || type == LVAL_DBL,
+                "Function '%s' called with non-number", func);
+
+        if (type != LVAL_NUM)
+            fixnums = 0;
+    }
+
+    if (fixnums)
+    {
+        long m = q->cell[0]->num;
+
+        for (int i = 1; i < q->count; i++)
+        {
+            m = max ? max_l(m, q->cell[i]->num) : min_l(m, q->cell[i]->num);
+        }
+
+        lval_del(v);
+        return lval_num(m);
+    }
+
+    int best = 0;
+    for (int i = 1; i < q->count; i++)
+    {
+        int c = lval_num_cmp(q->cell[i], q->cell[best]);
+        if (max ? c > 0 : c < 0)
+            best = i;
+    }
+
+    lval *x = lval_pop(q, best);
+    lval_del(v);
+    return x;
+}
+
+lval *builtin_min(lenv *e, lval *v)
+{
+    return builtin_extreme(e, v, "min");
+}
+
+lval *builtin_max(lenv *e, lval *v)
+{
+    return builtin_extreme(e, v, "max");
+}
+
+// Folds op over the elements of a single Q-expression
+lval *builtin_fold(lenv *e, lval *v, char *func, char *op)
+{
+    LASSERT(v, v->count == 1,
+            "Function '%s' called with wrong number of arguments", func);
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_VEC ||
+                   v->cell[0]->type == LVAL_RANGE,
+            "Function '%s' called with wrong type", func);
+
+    lval *q = lval_take(v, 0);
+
+    if (q->type == LVAL_RANGE)
+    {
+        lval *x = lval_range_reduce(q, op[0]);
+        lval_del(q);
+        return x;
+    }
+
+    if (q->type == LVAL_VEC)
+    {
+        lval *x = lvec_reduce(q, op[0]);
+        lval_del(q);
+        return x;
+    }
+
+    if (q->count == 0)
+    {
+        lval_del(q);
+        return lval_num(op[0] == '*' ? 1 : 0);
+    }
+
+    return builtin_op(e, q, op);
+}
+
+lval *builtin_sum(lenv *e, lval *v)
+{
+    return builtin_fold(e, v, "sum", "+");
+}
+
+lval *builtin_product(lenv *e, lval *v)
+{
+    return builtin_fold(e, v, "product", "*");
+}
+
+lval *builtin_range(lenv *e, lval *v)
+{
+    LASSERT(v, v->count >= 1 && v->count <= 3,
+            "Function 'range' called with wrong number of arguments");
+
+    for (int i = 0; i < v->count; i++)
+    {
+        LASSERT(v, v->cell[i]->type == LVAL_NUM,
+                "Function 'range' called with wrong type");
+    }
+
+    // (range stop), (range start stop) or (range start stop step)
+    long start = v->count > 1 ? v->cell[0]->num : 0;
+    long stop = v->count > 1 ? v->cell[1]->num : v->cell[0]->num;
+    long step = v->count > 2 ? v->cell[2]->num : 1;
+
+    LASSERT(v, step != 0,
+            "Function 'range' called with step 0");
+
+    lval_del(v);
+    return lval_range(start, stop, step);
+}
+
+lval *builtin_vec(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 1,
+            "Function 'vec' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_RANGE,
+            "Function 'vec' called with wrong type");
+
+    if (v->cell[0]->type == LVAL_RANGE)
+    {
+        lval *r = v->cell[0];
+        unsigned long n = lval_range_len(r);
+        long *d = n <= LONG_MAX / sizeof(long) ? malloc(sizeof(long) * n) : NULL;
+        LASSERT(v, d || n == 0,
+                "Function 'vec' called with range too long to store");
+
+        for (unsigned long i = 0; i < n; i++)
+            d[i] = lval_range_at(r, i);
+
+        lval_del(v);
+        return lval_vec(n, d, NULL);
+    }
+
+    lval *q = v->cell[0];
+    int dbls = 0;
+
+    for (int i = 0; i < q->count; i++)
+    {
+        LASSERT(v, q->cell[i]->type == LVAL_NUM || q->cell[i]->type == LVAL_DBL,
+                "Function 'vec' called with element that is not a long or double");
+
+        if (q->cell[i]->type == LVAL_DBL)
+            dbls = 1;
+    }
+
+    lval *x;
+    if (dbls)
+    {
+        double *d = malloc(sizeof(double) * q->count);
+        for (int i = 0; i < q->count; i++)
+            d[i] = lval_to_dbl(q->cell[i]);
+        x = lval_vec(q->count, NULL, d);
+    }
+    else
+    {
+        long *d = malloc(sizeof(long) * q->count);
+        for (int i = 0; i < q->count; i++)
+            d[i] = q->cell[i]->num;
+        x = lval_vec(q->count, d, NULL);
+    }
+
+    lval_del(v);
+    return x;
+}
+
+lval *builtin_mat(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 1,
+            "Function 'mat' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR,
+            "Function 'mat' called with wrong type");
+
+    lval *q = v->cell[0];
+    LASSERT(v, q->count != 0 && q->cell[0]->type == LVAL_QEXPR && q->cell[0]->count != 0,
+            "Function 'mat' called with empty {}");
+
+    long rows = q->count;
+    long cols = q->cell[0]->count;
+
+    for (int i = 0; i < q->count; i++)
+    {
+        lval *row = q->cell[i];
+        LASSERT(v, row->type == LVAL_QEXPR && row->count == cols,
+                "Function 'mat' called with rows of different lengths");
+
+        for (int j = 0; j < row->count; j++)
+        {
+            int type = row->cell[j]->type;
+            LASSERT(v, type == LVAL_NUM || type == LVAL_BIG || type == LVAL_DBL,
+                    "Function 'mat' called with non-number");
+        }
+    }
+
+    double *d = malloc(sizeof(double) * rows * cols);
+    for (long i = 0; i < rows; i++)
+    {
+        for (long j = 0; j < cols; j++)
+            d[i * cols + j] = lval_to_dbl(q->cell[i]->cell[j]);
+    }
+
+    lval_del(v);
+    return lval_mat(rows, cols, d);
+}
+
+lval *builtin_matmul(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 2,
+            "Function 'matmul' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_MAT && v->cell[1]->type == LVAL_MAT,
+            "Function 'matmul' called with wrong type");
+    LASSERT(v, v->cell[0]->cols == v->cell[1]->rows,
+            "Function 'matmul' called with mismatched dimensions");
+
+    lval *a = v->cell[0];
+    lval *b = v->cell[1];
+
+    lmat_mul_ctx ctx;
+    ctx.a = a->dbls;
+    ctx.b = b->dbls;
+    ctx.c = calloc(a->rows * b->cols, sizeof(double));
+    ctx.k = a->cols;
+    ctx.m = b->cols;
+
+    // Hand each thread whole row tiles, and only once there are at least
+    // a million multiply-adds per tile to be worth a thread
+    long work = a->cols * b->cols;
+    long grain = work >= (1L << 20) / MATMUL_BI ? MATMUL_BI : a->rows;
+    lpar_for(a->rows, grain, lmat_mul_rows, &ctx);
+
+    lval *x = lval_mat(a->rows, b->cols, ctx.c);
+    lval_del(v);
+    return x;
+}
+
+// Turns a range into the Q-expr of its numbers; anything else is returned
+// as it is. A range with more numbers than a Q-expr can count, or than
+// there is memory for, is an error instead.
+lval *lval_range_force(lval *v)
+{
+    if (v->type != LVAL_RANGE)
+        return v;
+
+    unsigned long n = lval_range_len(v);
+    lval *x = lval_qexpr();
+    x->cell = n <= INT_MAX ? malloc(sizeof(lval *) * n) : NULL;
+
+    if (!x->cell && n != 0)
+    {
+        lval_del(x);
+        lval_del(v);
+        return lval_err("Range too long to make a Q-expression!");
+    }
+
+    x->count = n;
+
+    for (unsigned long i = 0; i < n; i++)
+        x->cell[i] = lval_num(lval_range_at(v, i));
+
+    lval_del(v);
+    return x;
+}
+
+// Joins two ranges into one when the second carries on where the first
+// stops, consuming both; otherwise returns NULL and leaves them alone
+lval *lval_range_join(lval *x, lval *y)
+{
+    unsigned long nx = lval_range_len(x);
+    unsigned long ny = lval_range_len(y);
+
+    if (nx == 0 || ny == 0)
+    {
+        lval *keep = nx == 0 ? y : x;
+        lval_del(nx == 0 ? x : y);
+        return keep;
+    }
+
+    long next;
+    if (x->step != y->step ||
+        __builtin_add_overflow(lval_range_at(x, nx - 1), x->step, &next) ||
+        next != y->start)
+        return NULL;
+
+    x->stop = y->stop;
+    lval_del(y);
+    return x;
+}
+
+lval *builtin_head(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 1,
+            "Function 'head' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_RANGE,
+            "Function 'head' called with wrong type");
+
+    if (v->cell[0]->type == LVAL_RANGE)
+    {
+        LASSERT(v, lval_range_len(v->cell[0]) != 0,
+                "Function 'head' called with empty {}");
+
+        lval *head = lval_add(lval_qexpr(), lval_num(v->cell[0]->start));
+        lval_del(v);
+        return head;
+    }
+
+    LASSERT(v, v->cell[0]->count != 0,
+            "Function 'head' called with empty {}");
+
+    lval *head = lval_take(v, 0);
+
+    for (int i = 1; i < head->count; i++)
+    {
+        lval_del(head->cell[i]);
+    }
+
+    head->count = 1;
+    head->cell = realloc(head->cell, sizeof(lval *));
+
+    return head;
+}
+
+lval *builtin_tail(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 1,
+            "Function 'tail' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_RANGE,
+            "Function 'tail' called with wrong type");
+
+    if (v->cell[0]->type == LVAL_RANGE)
+    {
+        unsigned long n = lval_range_len(v->cell[0]);
+        LASSERT(v, n != 0,
+                "Function 'tail' called with empty {}");
+
+        lval *tail = lval_take(v, 0);
+        tail->start = n == 1 ? tail->stop : tail->start + tail->step;
+        return tail;
+    }
+
+    LASSERT(v, v->cell[0]->count != 0,
+            "Function 'tail' called with empty {}");
+
+    lval *tail = lval_take(v, 0);
+
+    lval_del(lval_pop(tail, 0));
+    return tail;
+}
+
+lval *builtin_list(lenv *e, lval *v)
+{
+    v->type = LVAL_QEXPR;
+    return v;
+}
+
+lval *builtin_eval(lenv *e, lval *v)
+{
+    LASSERT(v, v->count == 1,
+            "Function 'eval' called with wrong number of arguments");
+    LASSERT(v, v->cell[0]->type == LVAL_QEXPR || v->cell[0]->type == LVAL_RANGE,
+            "Function 'eval' called with wrong type");
+
+    // A range evaluates like the Q-expr of its numbers would: empty gives
+    // (), one number gives itself and more than one has no function
+    if (v->cell[0]->type == LVAL_RANGE)
+    {
+        unsigned long n = lval_range_len(v->cell[0]);
+        long first = v->cell[0]->start;
+        lval_del(v);
+
+        if (n == 0)
+            return lval_sexpr();
+        if (n == 1)
+            return lval_num(first);
+        return lval_err("first element is not a function");
+    }
+
+    lval *vv = lval_take(v, 0);
+    vv->type = LVAL_SEXPR;
+
+    return lval_eval(e, vv);
+}
+
+lval *builtin_join(lenv *e, lval *v)
+{
+    for (int i = 0; i < v->count; i++)
+    {
+        LASSERT(v, v->cell[i]->type == LVAL_QEXPR || v->cell[i]->type == LVAL_RANGE,
+                "Function 'join' called with wrong type");
+    }
+
+    lval *vv = lval_pop(v, 0);
+
+    while (v->count)
+    {
+        lval *y = lval_pop(v, 0);
+
+        if (vv->type == LVAL_RANGE && y->type == LVAL_RANGE)
+        {
+            lval *r = lval_range_join(vv, y);
+            if (r)
+            {
+                vv = r;
+                continue;
+            }
+        }
+
+        vv = lval_join(lval_range_force(vv), lval_range_force(y));
+        if (vv->type == LVAL_ERR)
+            break;
+    }
+
+    lval_del(v);
+    return vv;
+}
+
+// Appends the cells of y to x, consuming both. Either may be an error, which
+// is then the result, as is one when the cells do not fit in a Q-expr.
+lval *lval_join(lval *x, lval *y)
+{
+    if (x->type == LVAL_ERR || y->type == LVAL_ERR)
+    {
+        lval *err = x->type == LVAL_ERR ? x : y;
+        lval_del(err == x ? y : x);
+        return err;
+    }
+
+    lval **cell = x->count <= INT_MAX - y->count
+                      ? realloc(x->cell, sizeof(lval *) * (x->count + y->count))
+                      : NULL;
+
+    if (!cell && x->count + (long)y->count != 0)
+    {
+        lval_del(x);
+        lval_del(y);
+        return lval_err("Q-expression too long to join!");
+    }
+
+    x->cell = cell;
+    if (y->count)
+        memcpy(&x->cell[x->count], y->cell, sizeof(lval *) * y->count);
+    x->count += y->count;
+
+    free(y->cell);
+    free(y);
+    return x;
+}
+
+lval *builtin_def(lenv *e, lval *a)
+{
+    LASSERT(a, a->cell[0]->type == LVAL_QEXPR,
+            "Function 'def' called with wrong type");
+
+    lval *syms = a->cell[0];
+
+    for (int i = 0; i < syms->count; i++)
+    {
+        LASSERT(a, syms->cell[i]->type == LVAL_SYM,
+                "Function 'def' cannot define non-symbol")
+    }
+
+    LASSERT(a, syms->count == a->count - 1,
+            "Function 'def' cannot define incorrect number of values to symbols");
 
     for (int i = 0; i < syms->count; i++)
     {
@@ -593,19 +3020,20 @@ lval *builtin_def(lenv *e, lval *a)
 //     return lval_err("Unknown Function!");
 // }
 
-lval *lval_eval_sexpr(lenv *e, lval *v)
+// Applies an S-expression whose elements have all been evaluated. The first
+// error among them is the result. Otherwise fun, when given, is called on
+// them all, and without it the head is called on the rest.
+lval *lval_apply(lenv *e, lval *v, lbuiltin fun)
 {
-    for (int i = 0; i < v->count; i++)
-    {
-        v->cell[i] = lval_eval(e, v->cell[i]);
-    }
-
     for (int i = 0; i < v->count; i++)
     {
         if (v->cell[i]->type == LVAL_ERR)
             return lval_take(v, i);
     }
 
+    if (fun)
+        return fun(e, v);
+
     if (v->count == 0)
         return v;
 
@@ -626,6 +3054,30 @@ lval *lval_eval_sexpr(lenv *e, lval *v)
     return result;
 }
 
+lval *lval_eval_sexpr(lenv *e, lval *v)
+{
+    // A head symbol bound to a builtin is called straight from the binding,
+    // rather than copied out of the environment and freed after the call.
+    // The binding is read at every call, so a later 'def' still takes effect.
+    lbuiltin fun = NULL;
+    if (v->count > 1 && v->cell[0]->type == LVAL_SYM)
+    {
+        lval *f = lenv_lookup(e, v->cell[0]->sym);
+        if (f && f->type == LVAL_FUN)
+            fun = f->fun;
+    }
+
+    if (fun)
+        lval_del(lval_pop(v, 0));
+
+    for (int i = 0; i < v->count; i++)
+    {
+        v->cell[i] = lval_eval(e, v->cell[i]);
+    }
+
+    return lval_apply(e, v, fun);
+}
+
 lval *lval_eval(lenv *e, lval *v)
 {
     if (v->type == LVAL_SYM)
@@ -650,76 +3102,358 @@ void lenv_add_builtin(lenv *e, char *name, lbuiltin func)
     lval_del(v);
 }
 
+#define LBUILTIN(name, fun) {name, #fun, fun}
+
+lbuiltin_entry lbuiltins[] = {
+    LBUILTIN("list", builtin_list),
+    LBUILTIN("head", builtin_head),
+    LBUILTIN("tail", builtin_tail),
+    LBUILTIN("eval", builtin_eval),
+    LBUILTIN("join", builtin_join),
+
+    LBUILTIN("+", builtin_add),
+    LBUILTIN("-", builtin_sub),
+    LBUILTIN("*", builtin_mul),
+    LBUILTIN("/", builtin_div),
+    LBUILTIN("^", builtin_pow),
+    LBUILTIN("pow", builtin_pow),
+    LBUILTIN("powmod", builtin_powmod),
+
+    LBUILTIN("min", builtin_min),
+    LBUILTIN("max", builtin_max),
+    LBUILTIN("sum", builtin_sum),
+    LBUILTIN("product", builtin_product),
+    LBUILTIN("vec", builtin_vec),
+    LBUILTIN("range", builtin_range),
+    LBUILTIN("mat", builtin_mat),
+    LBUILTIN("matmul", builtin_matmul),
+
+    LBUILTIN("def", builtin_def),
+    {NULL, NULL, NULL},
+};
+
 void lenv_add_builtins(lenv *e)
 {
-    lenv_add_builtin(e, "list", builtin_list);
-    lenv_add_builtin(e, "head", builtin_head);
-    lenv_add_builtin(e, "tail", builtin_tail);
-    lenv_add_builtin(e, "eval", builtin_eval);
-    lenv_add_builtin(e, "join", builtin_join);
+    for (lbuiltin_entry *b = lbuiltins; b->name; b++)
+        lenv_add_builtin(e, b->name, b->fun);
+}
+
+// Reads a whole file into a NUL-terminated buffer, setting len to the
+// number of bytes read, which a NUL in the file makes more than its strlen
+char *lval_slurp(char *filename, long *len)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return NULL;
 
-    lenv_add_builtin(e, "+", builtin_add);
-    lenv_add_builtin(e, "-", builtin_sub);
-    lenv_add_builtin(e, "*", builtin_mul);
-    lenv_add_builtin(e, "/", builtin_div);
+    size_t cap = 4096, size = 0, n;
+    char *buf = malloc(cap);
+
+    while ((n = fread(buf + size, 1, cap - size - 1, f)) > 0)
+    {
+        size += n;
+        if (size + 1 == cap)
+        {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
 
-    lenv_add_builtin(e, "def", builtin_def);
+    fclose(f);
+    buf[size] = '\0';
+    *len = size;
+    return buf;
 }
 
-int main(int argc, char **argv)
+// Scripts echo the value of each top-level form, except the empty
+// expression that definitions evaluate to.
+void lval_load_print(lval *x)
 {
-    mpc_parser_t *integer = mpc_new("integer");
-    mpc_parser_t *decimal = mpc_new("decimal");
-    mpc_parser_t *number = mpc_new("number");
-    mpc_parser_t *symbol = mpc_new("symbol");
-    mpc_parser_t *sexpr = mpc_new("sexpr");
-    mpc_parser_t *qexpr = mpc_new("qexpr");
-    mpc_parser_t *expr = mpc_new("expr");
-    mpc_parser_t *lispy = mpc_new("lispy");
+    if (x->type != LVAL_SEXPR || x->count != 0)
+        lval_println(x);
 
-    mpca_lang(MPCA_LANG_DEFAULT,
-              "\
-            integer : /-?\\d+/ ; \
-            decimal : /-?\\d+\\.\\d+/ ; \
-            number :  <decimal> | <integer> ; \
-            symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&]+/ ; \
-            sexpr : '(' <expr>* ')' ; \
-            qexpr : '{' <expr>* '}' ; \
-            expr : <number> | <symbol> | <sexpr> | <qexpr> ; \
-            lispy : /^/ <expr>* /$/ ; \
-          ",
-              integer, decimal, number, symbol, sexpr, qexpr, expr, lispy);
+    lval_del(x);
+}
+
+void lval_load_form(lenv *e, lval *form)
+{
+    lval_load_print(lval_eval(e, form));
+}
 
-    puts("Lispy Version 0.0.0.0.1");
-    puts("Press Ctrl+c to Exit\n");
+// Evaluates the forms read from a script, or returns 1 if they could not
+// be read
+int lval_load_forms(lenv *e, lval *forms)
+{
+    if (!forms)
+        return 1;
 
-    lenv *e = lenv_new();
-    lenv_add_builtins(e);
+    for (int i = 0; i < forms->count; i++)
+        lval_load_form(e, forms->cell[i]);
+
+    forms->count = 0;
+    lval_del(forms);
+    return 0;
+}
 
-    while (1)
+#ifndef LISPY_MPC_READER
+// Moves a position in a script past n characters of it
+void lread_advance(mpc_state_t *at, char *s, long n)
+{
+    for (long i = 0; i < n; i++)
     {
-        char *input = readline("(lispy)> ");
-        add_history(input);
+        at->col = s[i] == '\n' ? 0 : at->col + 1;
+        at->row += s[i] == '\n';
+        at->pos++;
+    }
+}
+
+// Reports the NUL byte n characters past position at in a script, the
+// first of s. The readers would take it for the end of the input and
+// silently drop the rest, so it is an error like any other stray byte.
+int lread_nul(char *filename, char *s, long n, mpc_state_t at)
+{
+    lread_advance(&at, s, n);
+    printf("%s:%li:%li: error: unexpected NUL byte\n", filename, at.row + 1, at.col + 1);
+    return 1;
+}
+#endif
+
+int lval_load(lenv *e, mpc_parser_t *lispy, char *filename)
+{
+#ifdef LISPY_MPC_READER
+    // mpc maps regular files itself, so there is nothing to read first
+    mpc_result_t r;
+    lval *forms = lval_read_result(mpc_parse_contents(filename, lispy, &r), &r);
+#else
+    long len;
+    char *input = lval_slurp(filename, &len);
 
+    // Let mpc report files that cannot be opened
+    if (!input)
+    {
         mpc_result_t r;
-        if (mpc_parse("<stdin>", input, lispy, &r))
-        {
-            lval *result = lval_eval(e, lval_read(r.output));
-            lval_println(result);
-            lval_del(result);
-            mpc_ast_delete(r.output);
-        }
-        else
+        if (!mpc_parse_contents(filename, lispy, &r))
         {
             mpc_err_print(r.error);
             mpc_err_delete(r.error);
+            return 1;
         }
+        mpc_ast_delete(r.output);
+        return 1;
+    }
 
+    long n = strlen(input);
+    if (n < len)
+    {
+        lread_nul(filename, input, n, (mpc_state_t){0});
         free(input);
+        return 1;
     }
 
-    lenv_del(e);
+    lval *forms = lval_parse(lispy, filename, input);
+    free(input);
+#endif
+
+    return lval_load_forms(e, forms);
+}
+
+#ifndef LISPY_MPC_READER
+// Bytes read from a streamed script at a time
+#define LREAD_STREAM_CHUNK 4096
+
+// Reads and evaluates the forms of a run of a streamed script one at a time,
+// up to the first that is not valid Lispy. mpc reports that one, moved from
+// the run to where it is in the file.
+int lval_load_run(lenv *e, mpc_parser_t *lispy, char *filename, char *run, mpc_state_t at)
+{
+    lreader r = {run, 0};
+    lread_skip_space(&r);
+
+    while (run[r.pos] != '\0')
+    {
+        long start = r.pos;
+        lval *x = lread_expr(&r);
+        if (x)
+        {
+            lval_load_form(e, x);
+            continue;
+        }
+
+        mpc_result_t res;
+        int ok = mpc_parse(filename, run + start, lispy, &res);
+        if (!ok)
+        {
+            lread_advance(&at, run, start);
+            if (res.error->state.row == 0)
+                res.error->state.col += at.col;
+            res.error->state.row += at.row;
+            res.error->state.pos += at.pos;
+        }
+        return lval_load_forms(e, lval_read_result(ok, &res));
+    }
 
-    mpc_cleanup(8, integer, decimal, number, symbol, sexpr, qexpr, expr, lispy);
     return 0;
 }
+
+// Reads a script a chunk at a time and evaluates each form as soon as it is
+// complete. Whitespace outside any brackets, which no token spans, ends a
+// run of whole forms, and so does the bracket closing the outermost one, so
+// only the run being read is ever kept even with no space between forms.
+int lval_load_runs(lenv *e, mpc_parser_t *lispy, char *filename, FILE *f)
+{
+    size_t len = 0;
+    size_t cap = 2 * LREAD_STREAM_CHUNK;
+    char *buf = malloc(cap);
+    long depth = 0;
+    mpc_state_t at = {0};
+    int more = 1;
+    int status = 0;
+
+    while (status == 0 && more)
+    {
+        if (cap - len < LREAD_STREAM_CHUNK)
+        {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+
+        // A line at a time, so forms typed at a terminal run when entered
+        size_t end = len;
+        int got = 0;
+        while (end - len < LREAD_STREAM_CHUNK - 1 && got != '\n' && (got = getc(f)) != EOF)
+            buf[end++] = got;
+        more = got != EOF;
+        buf[end] = '\0';
+
+        // The end of the input closes the last form, even inside brackets
+        size_t start = 0;
+        for (size_t i = len; i < end + !more && status == 0; i++)
+        {
+            char c = buf[i];
+            if (c == '\0' && i < end)
+            {
+                status = lread_nul(filename, buf + start, i - start, at);
+                break;
+            }
+
+            depth += (c == '(' || c == '{') - (c == ')' || c == '}');
+            int closed = (c == ')' || c == '}') && depth == 0;
+            if (c != '\0' && !closed && (depth > 0 || !lread_is_space(c)))
+                continue;
+
+            // A closing bracket is the last of its run, whitespace after it
+            size_t stop = closed ? i + 1 : i;
+            if (stop > start)
+            {
+                char after = buf[stop];
+                buf[stop] = '\0';
+                status = lval_load_run(e, lispy, filename, buf + start, at);
+                buf[stop] = after;
+            }
+
+            size_t next = i < end ? i + 1 : end;
+            lread_advance(&at, buf + start, next - start);
+            start = next;
+        }
+
+        len = end - start;
+        memmove(buf, buf + start, len);
+    }
+
+    free(buf);
+    return status;
+}
+#endif
+
+// Loads a script one top-level form at a time, freeing each before the next
+// is read, so memory stays in proportion to the largest form rather than
+// the whole file. Unlike lval_load, the forms before a syntax error have
+// already run when it is reported. "-" reads standard input.
+int lval_load_stream(lenv *e, mpc_parser_t *lispy, mpc_parser_t *form, char *filename)
+{
+    FILE *f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb");
+
+    // Let mpc report files that cannot be opened
+    if (!f)
+    {
+        mpc_result_t r;
+        lval *forms = lval_read_result(mpc_parse_contents(filename, form, &r), &r);
+        if (forms)
+            lval_del(forms);
+        return 1;
+    }
+
+#ifdef LISPY_MPC_READER
+    mpc_stream_t *s = mpc_stream_new(filename, f);
+    int status = 0;
+
+    while (status == 0 && !mpc_stream_done(s))
+    {
+        mpc_result_t r;
+        status = lval_load_forms(e, lval_read_result(mpc_parse_stream(s, form, &r), &r));
+    }
+
+    mpc_stream_delete(s);
+#else
+    int status = lval_load_runs(e, lispy, filename, f);
+#endif
+
+    if (f != stdin)
+        fclose(f);
+    return status;
+}
+
+#ifndef LISPY_NO_MAIN
+int main(int argc, char **argv)
+{
+    lgrammar g;
+    lgrammar_new(&g);
+
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    int status = 0;
+
+    // --stream loads the files after it one form at a time, or standard
+    // input when no file follows
+    int stream = argc > 1 && strcmp(argv[1], "--stream") == 0;
+
+    if (stream && argc == 2)
+    {
+        status |= lval_load_stream(e, g.lispy, g.form, "-");
+    }
+    else if (argc > 1)
+    {
+        for (int i = 1 + stream; i < argc; i++)
+        {
+            status |= stream ? lval_load_stream(e, g.lispy, g.form, argv[i]) : lval_load(e, g.lispy, argv[i]);
+        }
+    }
+    else
+    {
+        puts("Lispy Version 0.0.0.0.1");
+        puts("Press Ctrl+c to Exit\n");
+
+        while (1)
+        {
+            char *input = readline("(lispy)> ");
+            add_history(input);
+
+            lval *x = lval_parse(g.lispy, "<stdin>", input);
+            if (x)
+            {
+                lval *result = lval_eval(e, x);
+                lval_println(result);
+                lval_del(result);
+            }
+
+            free(input);
+        }
+    }
+
+    lenv_del(e);
+
+    lgrammar_del(&g);
+    return status;
+}
+#endif // LISPY_NO_MAIN
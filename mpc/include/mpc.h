@@ -74,6 +74,18 @@ int mpc_parse_file(const char *filename, FILE *file, mpc_parser_t *p, mpc_result
 int mpc_parse_pipe(const char *filename, FILE *pipe, mpc_parser_t *p, mpc_result_t *r);
 int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r);
 
+/*
+** Streams
+*/
+
+struct mpc_stream_t;
+typedef struct mpc_stream_t mpc_stream_t;
+
+mpc_stream_t *mpc_stream_new(const char *filename, FILE *file);
+void mpc_stream_delete(mpc_stream_t *s);
+int mpc_stream_done(mpc_stream_t *s);
+int mpc_parse_stream(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r);
+
 /*
 ** Function Types
 */
@@ -293,6 +305,9 @@ typedef struct mpc_ast_t
     mpc_state_t state;
     int children_num;
     struct mpc_ast_t** children;
+    struct mpc_ast_arena_t *arena;
+    size_t contents_len;
+    int children_slots;
 } mpc_ast_t;
 
 mpc_ast_t *mpc_ast_new(const char *tag, const char *contents);
@@ -304,6 +319,17 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t);
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s);
 
+enum
+{
+    MPC_TAG_ROOT   = 0,
+    MPC_TAG_REGEX  = 1,
+    MPC_TAG_STRING = 2,
+    MPC_TAG_CHAR   = 3
+};
+
+int mpc_tag_id(const char *tag);
+int mpc_ast_tagged(mpc_ast_t *a, int id);
+
 void mpc_ast_delete(mpc_ast_t *a);
 void mpc_ast_print(mpc_ast_t *a);
 void mpc_ast_print_to(mpc_ast_t *a, FILE *fp);
@@ -363,7 +389,9 @@ enum
 {
     MPCA_LANG_DEFAULT              = 0,
     MPCA_LANG_PREDICTIVE           = 1,
-    MPCA_LANG_WHITESPACE_SENSITIVE = 2
+    MPCA_LANG_WHITESPACE_SENSITIVE = 2,
+    MPCA_LANG_PACKRAT              = 4,
+    MPCA_LANG_SLICES               = 8
 };
 
 mpc_parser_t *mpca_grammar(int flags, const char *grammar, ...);
@@ -380,6 +408,7 @@ mpc_err_t *mpca_lang_contents(int flags, const char *filename, ...);
 
 void mpc_print(mpc_parser_t *p);
 void mpc_optimise(mpc_parser_t *p);
+void mpc_analyse(mpc_parser_t *p);
 void mpc_stats(mpc_parser_t *p);
 
 int mpc_test_pass(mpc_parser_t *p, const char *s, const void *d,
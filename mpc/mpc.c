@@ -1,5 +1,12 @@
 #include "mpc.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MPC_USE_MMAP
+#endif
+
 /*
 ** State Type
 */
@@ -43,20 +50,24 @@ static mpc_state_t mpc_state_new(void)
 ** by seeking in the file at different positions.
 **
 ** The final mode is Pipe. This is the difficult
-** one. As we assume pipes cannot be seeked - and
-** only support a single character lookahead at
-** any point, when the input is marked for a
-** potential backtracking we start buffering any
-** input.
+** one. As we assume pipes cannot be seeked, the
+** input is read a line or block at a time into a
+** buffer, which holds everything from the oldest
+** mark onwards, or from the cursor when nothing is
+** marked.
 **
 ** This means that if we are requested to seek
-** back we can simply start reading from the
-** buffer instead of the input.
+** back we can simply index into the buffer, and
+** only input no mark can reach is ever dropped.
 **
 ** Of course using `mpc_predictive` will disable
 ** backtracking and make LL(1) grammars easy
 ** to parse for all input methods.
 **
+** Where mmap is available, regular files given to
+** `mpc_parse_contents` are instead mapped into memory
+** and read as a String.
+**
 */
 
 enum
@@ -76,6 +87,543 @@ enum
     MPC_INPUT_MEM_NUM = 512
 };
 
+enum
+{
+    MPC_INPUT_PIPE_CHUNK = 4096
+};
+
+/*
+** Tag IDs. Each name a tag is made of is given a
+** small integer ID when a parser is built with it or
+** mpc_tag_id is called, which it keeps until the last
+** named parser is cleaned up. Named parsers take theirs
+** when created, and the tags mpca adds by itself have
+** the fixed IDs in mpc.h. Parsing only looks names up
+** and never writes the registry.
+*/
+
+enum
+{
+    MPC_TAGS_MIN = 64
+};
+
+static struct
+{
+    int num;
+    int slots;
+    int parsers;
+    char **names;
+    int *table;
+} mpc_tags;
+
+static const char *mpc_tags_fixed[] = { ">", "regex", "string", "char" };
+
+static unsigned long mpc_tag_hash(const char *s, size_t n)
+{
+    unsigned long h = 5381;
+    while (n--)
+    {
+        h = h * 33 + (unsigned char)*s++;
+    }
+    return h;
+}
+
+static int mpc_tag_lookup(const char *s, size_t n)
+{
+    unsigned long k;
+    char *name;
+
+    if (mpc_tags.slots == 0)
+    {
+        return -1;
+    }
+
+    k = mpc_tag_hash(s, n) & (mpc_tags.slots - 1);
+    while (mpc_tags.table[k] != -1)
+    {
+        name = mpc_tags.names[mpc_tags.table[k]];
+        if (strncmp(name, s, n) == 0 && name[n] == '\0')
+        {
+            return mpc_tags.table[k];
+        }
+        k = (k + 1) & (mpc_tags.slots - 1);
+    }
+    return -1;
+}
+
+static int mpc_tag_find(const char *s, size_t n)
+{
+    int j;
+    unsigned long k;
+    char *name;
+
+    j = mpc_tag_lookup(s, n);
+    if (j != -1)
+    {
+        return j;
+    }
+
+    if (mpc_tags.num * 2 >= mpc_tags.slots)
+    {
+        mpc_tags.slots = mpc_tags.slots ? mpc_tags.slots * 2 : MPC_TAGS_MIN;
+        mpc_tags.names = realloc(mpc_tags.names, sizeof(char*) * mpc_tags.slots);
+        free(mpc_tags.table);
+        mpc_tags.table = malloc(sizeof(int) * mpc_tags.slots);
+        for (j = 0; j < mpc_tags.slots; j++)
+        {
+            mpc_tags.table[j] = -1;
+        }
+        for (j = 0; j < mpc_tags.num; j++)
+        {
+            name = mpc_tags.names[j];
+            k = mpc_tag_hash(name, strlen(name)) & (mpc_tags.slots - 1);
+            while (mpc_tags.table[k] != -1)
+            {
+                k = (k + 1) & (mpc_tags.slots - 1);
+            }
+            mpc_tags.table[k] = j;
+        }
+    }
+
+    k = mpc_tag_hash(s, n) & (mpc_tags.slots - 1);
+    while (mpc_tags.table[k] != -1)
+    {
+        k = (k + 1) & (mpc_tags.slots - 1);
+    }
+
+    name = malloc(n + 1);
+    memcpy(name, s, n);
+    name[n] = '\0';
+    mpc_tags.names[mpc_tags.num] = name;
+    mpc_tags.table[k] = mpc_tags.num;
+    return mpc_tags.num++;
+}
+
+int mpc_tag_id(const char *tag)
+{
+    int j;
+    if (mpc_tags.num == 0)
+    {
+        for (j = 0; j < 4; j++)
+        {
+            mpc_tag_find(mpc_tags_fixed[j], strlen(mpc_tags_fixed[j]));
+        }
+    }
+    return mpc_tag_find(tag, strlen(tag));
+}
+
+static void mpc_tags_free(void)
+{
+    int j;
+    for (j = 0; j < mpc_tags.num; j++)
+    {
+        free(mpc_tags.names[j]);
+    }
+    free(mpc_tags.names);
+    free(mpc_tags.table);
+    mpc_tags.num = 0;
+    mpc_tags.slots = 0;
+    mpc_tags.names = NULL;
+    mpc_tags.table = NULL;
+}
+
+/*
+** AST arena. Trees built while parsing are bump
+** allocated in blocks owned by the input, with each
+** tag string stored once and each child array sized
+** to fit. When a parse succeeds the arena passes to
+** the root of its result, so deleting that root frees
+** the whole tree at once, and deleting any other node
+** of an arena does nothing. Heap allocated nodes made
+** children of arena nodes are adopted by the arena.
+**
+** Parsers defined with MPCA_LANG_SLICES leave the
+** contents of leaves parsed from a string in place:
+** they point into the input's copy of the string,
+** which the arena then keeps, and are not terminated,
+** so only the first contents_len bytes belong to them.
+**
+** Interned tags are preceded by the set of tag IDs
+** they are made of, so testing a node for a name is
+** a bit test rather than a string search.
+*/
+
+enum
+{
+    MPC_AST_ARENA_BLOCK_MIN = 4096,
+    MPC_AST_ARENA_BLOCK_MAX = 1048576,
+    MPC_AST_ARENA_TAGS_MIN  = 32,
+    MPC_AST_ARENA_ADOPTED_MIN = 8,
+    MPC_AST_ARENA_CHILDREN_MIN = 4
+};
+
+typedef union
+{
+    long l;
+    double d;
+    void *p;
+} mpc_ast_align_t;
+
+/*
+** A tag with a name no parser was built with has no
+** bitset, and ids_num is -1 so that mpc_ast_tagged
+** compares its names instead.
+*/
+typedef struct
+{
+    int ids_num;
+    unsigned char *ids;
+} mpc_ast_tag_t;
+
+typedef struct mpc_ast_block_t
+{
+    struct mpc_ast_block_t *prev;
+    size_t size;
+    mpc_ast_align_t align;
+} mpc_ast_block_t;
+
+typedef struct mpc_ast_arena_t
+{
+    mpc_ast_t *root;
+    char *text;
+    size_t text_mapped;
+
+    mpc_ast_block_t *block;
+    size_t used;
+
+    int tags_num;
+    int tags_slots;
+    char **tags;
+
+    int adopted_num;
+    int adopted_slots;
+    mpc_ast_t **adopted;
+} mpc_ast_arena_t;
+
+static mpc_ast_arena_t *mpc_ast_arena_new(void)
+{
+    mpc_ast_arena_t *a = malloc(sizeof(mpc_ast_arena_t));
+    a->root = NULL;
+    a->text = NULL;
+    a->text_mapped = 0;
+    a->block = NULL;
+    a->used = 0;
+    a->tags_num = 0;
+    a->tags_slots = 0;
+    a->tags = NULL;
+    a->adopted_num = 0;
+    a->adopted_slots = 0;
+    a->adopted = NULL;
+    return a;
+}
+
+/* Frees a string input, which may be a mapped file */
+static void mpc_text_free(char *s, size_t mapped)
+{
+#ifdef MPC_USE_MMAP
+    if (mapped)
+    {
+        munmap(s, mapped);
+        return;
+    }
+#endif
+    (void)mapped;
+    free(s);
+}
+
+static void mpc_ast_arena_delete(mpc_ast_arena_t *a)
+{
+    int j;
+    mpc_ast_block_t *b;
+
+    for (j = 0; j < a->adopted_num; j++)
+    {
+        mpc_ast_delete(a->adopted[j]);
+    }
+    free(a->adopted);
+    free(a->tags);
+    if (a->text)
+    {
+        mpc_text_free(a->text, a->text_mapped);
+    }
+
+    while (a->block)
+    {
+        b = a->block->prev;
+        free(a->block);
+        a->block = b;
+    }
+
+    free(a);
+}
+
+static void *mpc_ast_arena_alloc(mpc_ast_arena_t *a, size_t n)
+{
+    size_t size;
+    mpc_ast_block_t *b;
+
+    n = (n + sizeof(mpc_ast_align_t) - 1) / sizeof(mpc_ast_align_t) * sizeof(mpc_ast_align_t);
+
+    if (a->block == NULL || a->used + n > a->block->size)
+    {
+        size = a->block == NULL ? MPC_AST_ARENA_BLOCK_MIN : a->block->size;
+        size = size < MPC_AST_ARENA_BLOCK_MAX ? size * 2 : size;
+        size = size < n ? n : size;
+        b = malloc(sizeof(mpc_ast_block_t) + size);
+        b->prev = a->block;
+        b->size = size;
+        a->block = b;
+        a->used = 0;
+    }
+
+    a->used += n;
+    return (char*)(a->block + 1) + a->used - n;
+}
+
+static int mpc_ast_arena_owns(mpc_ast_arena_t *a, void *p)
+{
+    mpc_ast_block_t *b;
+    for (b = a->block; b; b = b->prev)
+    {
+        if ((char*)p >= (char*)(b + 1) && (char*)p < (char*)(b + 1) + b->size)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char *mpc_ast_arena_tag(mpc_ast_arena_t *a, const char *s)
+{
+    int id, max = -1;
+    const char *x, *y;
+    char *tag = mpc_ast_arena_alloc(a, sizeof(mpc_ast_tag_t) + strlen(s) + 1);
+    mpc_ast_tag_t *t = (mpc_ast_tag_t*)tag;
+
+    for (x = s; ; x = y + 1)
+    {
+        y = strchr(x, '|');
+        y = y ? y : x + strlen(x);
+        if (y > x)
+        {
+            id = mpc_tag_lookup(x, y - x);
+            if (id == -1)
+            {
+                t->ids_num = -1;
+                t->ids = NULL;
+                tag += sizeof(mpc_ast_tag_t);
+                strcpy(tag, s);
+                return tag;
+            }
+            max = id > max ? id : max;
+        }
+        if (*y == '\0')
+        {
+            break;
+        }
+    }
+
+    t->ids_num = max / 8 + 1;
+    t->ids = mpc_ast_arena_alloc(a, t->ids_num);
+    memset(t->ids, 0, t->ids_num);
+
+    for (x = s; ; x = y + 1)
+    {
+        y = strchr(x, '|');
+        y = y ? y : x + strlen(x);
+        if (y > x)
+        {
+            id = mpc_tag_lookup(x, y - x);
+            t->ids[id / 8] |= 1 << (id % 8);
+        }
+        if (*y == '\0')
+        {
+            break;
+        }
+    }
+
+    tag += sizeof(mpc_ast_tag_t);
+    strcpy(tag, s);
+    return tag;
+}
+
+static char *mpc_ast_arena_intern(mpc_ast_arena_t *a, const char *s)
+{
+    int j, slots;
+    unsigned long k;
+    char **tags;
+
+    if (a->tags_num * 2 >= a->tags_slots)
+    {
+        tags = a->tags;
+        slots = a->tags_slots;
+        a->tags_slots = slots ? slots * 2 : MPC_AST_ARENA_TAGS_MIN;
+        a->tags = calloc(a->tags_slots, sizeof(char*));
+        for (j = 0; j < slots; j++)
+        {
+            if (tags[j] == NULL)
+            {
+                continue;
+            }
+            k = mpc_tag_hash(tags[j], strlen(tags[j])) & (a->tags_slots - 1);
+            while (a->tags[k])
+            {
+                k = (k + 1) & (a->tags_slots - 1);
+            }
+            a->tags[k] = tags[j];
+        }
+        free(tags);
+    }
+
+    k = mpc_tag_hash(s, strlen(s)) & (a->tags_slots - 1);
+    while (a->tags[k])
+    {
+        if (strcmp(a->tags[k], s) == 0)
+        {
+            return a->tags[k];
+        }
+        k = (k + 1) & (a->tags_slots - 1);
+    }
+
+    a->tags[k] = mpc_ast_arena_tag(a, s);
+    a->tags_num++;
+    return a->tags[k];
+}
+
+static mpc_ast_t *mpc_ast_arena_node(mpc_ast_arena_t *a, const char *tag, const char *contents, size_t len)
+{
+    mpc_ast_t *n;
+
+    if (a == NULL)
+    {
+        n = mpc_ast_new(tag, "");
+        n->contents = realloc(n->contents, len + 1);
+    }
+    else
+    {
+        n = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t));
+        n->tag = mpc_ast_arena_intern(a, tag);
+        n->contents = mpc_ast_arena_alloc(a, len + 1);
+    }
+
+    memcpy(n->contents, contents, len);
+    n->contents[len] = '\0';
+    n->contents_len = len;
+
+    if (a == NULL)
+    {
+        return n;
+    }
+
+    n->state = mpc_state_new();
+    n->children_num = 0;
+    n->children_slots = 0;
+    n->children = NULL;
+    n->arena = a;
+    return n;
+}
+
+static mpc_ast_t **mpc_ast_arena_children(mpc_ast_arena_t *a, int n)
+{
+    if (n == 0)
+    {
+        return NULL;
+    }
+    if (a == NULL)
+    {
+        return malloc(sizeof(mpc_ast_t*) * n);
+    }
+    return mpc_ast_arena_alloc(a, sizeof(mpc_ast_t*) * n);
+}
+
+/* Make the arena responsible for deleting a node it did not allocate */
+static void mpc_ast_arena_adopt(mpc_ast_arena_t *a, mpc_ast_t *n)
+{
+    if (a == NULL || n == NULL || n->arena == a)
+    {
+        return;
+    }
+    if (n->arena && n->arena->root != n)
+    {
+        return;
+    }
+    if (a->adopted_num == a->adopted_slots)
+    {
+        a->adopted_slots = a->adopted_slots ? a->adopted_slots * 2 : MPC_AST_ARENA_ADOPTED_MIN;
+        a->adopted = realloc(a->adopted, sizeof(mpc_ast_t*) * a->adopted_slots);
+    }
+    a->adopted[a->adopted_num++] = n;
+}
+
+/* Copy a tree into an arena, or onto the heap when the arena is NULL */
+static mpc_ast_t *mpc_ast_arena_copy(mpc_ast_arena_t *a, mpc_ast_t *n)
+{
+    int j;
+    mpc_ast_t *m;
+
+    if (n == NULL)
+    {
+        return NULL;
+    }
+
+    if (a && n->arena == a)
+    {
+        m = mpc_ast_arena_node(a, n->tag, "", 0);
+        m->contents = n->contents;
+        m->contents_len = n->contents_len;
+    }
+    else
+    {
+        m = mpc_ast_arena_node(a, n->tag, n->contents, n->contents_len);
+    }
+    m->state = n->state;
+    m->children_num = n->children_num;
+    m->children_slots = n->children_num;
+    m->children = mpc_ast_arena_children(a, n->children_num);
+    for (j = 0; j < n->children_num; j++)
+    {
+        m->children[j] = mpc_ast_arena_copy(a, n->children[j]);
+    }
+    return m;
+}
+
+/*
+** Packrat memo table. Each slot holds the results
+** recorded at one input position, and a position
+** shares its slot with the positions a multiple of
+** the window before and after it, so only the most
+** recent window of positions is remembered and the
+** memory used stays bounded however long the input.
+*/
+
+enum
+{
+    MPC_INPUT_MEMO_WINDOW = 4096
+};
+
+typedef struct mpc_memo_t
+{
+    mpc_parser_t *parser;
+    int term;
+    int suppress;
+
+    int done;
+    int success;
+    mpc_state_t state;
+    char last;
+    mpc_val_t *output;
+    mpc_err_t *error;
+    mpc_err_t *side;
+
+    struct mpc_memo_t *next;
+} mpc_memo_t;
+
+typedef struct
+{
+    long pos;
+    mpc_memo_t *entries;
+} mpc_memo_slot_t;
+
 typedef struct
 {
     char mem[64];
@@ -89,7 +637,11 @@ typedef struct
     mpc_state_t state;
 
     char *string;
+    size_t mapped;
     char *buffer;
+    long buffer_pos;
+    size_t buffer_num;
+    size_t buffer_slots;
     FILE *file;
 
     int suppress;
@@ -105,6 +657,10 @@ typedef struct
     char mem_full[MPC_INPUT_MEM_NUM];
     mpc_mem_t mem[MPC_INPUT_MEM_NUM];
 
+    mpc_memo_slot_t *memo;
+    mpc_ast_arena_t *arena;
+    int slices;
+
 } mpc_input_t;
 
 static mpc_input_t *mpc_input_new_string(const char *filename, const char *string)
@@ -121,6 +677,9 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
     i->string = malloc(strlen(string) + 1);
     strcpy(i->string, string);
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_num = 0;
+    i->buffer_slots = 0;
     i->file = NULL;
 
     i->suppress = 0;
@@ -134,6 +693,11 @@ static mpc_input_t *mpc_input_new_string(const char *filename, const char *strin
     i->mem_index = 0;
     memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+    i->memo = NULL;
+    i->arena = NULL;
+    i->slices = 0;
+    i->mapped = 0;
+
     return i;
 }
 
@@ -152,6 +716,9 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
     strncpy(i->string, string, length);
     i->string[length] = '\0';
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_num = 0;
+    i->buffer_slots = 0;
     i->file = NULL;
 
     i->suppress = 0;
@@ -165,23 +732,78 @@ static mpc_input_t *mpc_input_new_nstring(const char *filename, const char *stri
     i->mem_index = 0;
     memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+    i->memo = NULL;
+    i->arena = NULL;
+    i->slices = 0;
+    i->mapped = 0;
+
     return i;
 
 }
 
-static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe)
+/*
+** Maps a regular file as a String input, or returns
+** NULL when it cannot be. The mapping lies over at
+** least one more page of zeroes, so like any other
+** String it is followed by a NUL, and it is private
+** and writable so the input can be handled the same.
+*/
+static mpc_input_t *mpc_input_new_map(const char *filename, FILE *file)
 {
+#ifdef MPC_USE_MMAP
+    struct stat st;
+    size_t page, len;
+    char *m;
+    mpc_input_t *i;
 
-    mpc_input_t *i = malloc(sizeof(mpc_input_t));
-
-    i->filename = malloc(strlen(filename) + 1);
-    strcpy(i->filename, filename);
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        return NULL;
+    }
 
-    i->type = MPC_INPUT_PIPE;
-    i->state = mpc_state_new();
+    page = (size_t)sysconf(_SC_PAGESIZE);
+    len = ((size_t)st.st_size / page + 1) * page;
 
-    i->string = NULL;
+    m = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (m == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (mmap(m, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+             fileno(file), 0) == MAP_FAILED)
+    {
+        munmap(m, len);
+        return NULL;
+    }
+
+    i = mpc_input_new_nstring(filename, "", 0);
+    free(i->string);
+    i->string = m;
+    i->mapped = len;
+    return i;
+#else
+    (void)filename;
+    (void)file;
+    return NULL;
+#endif
+}
+
+static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe)
+{
+
+    mpc_input_t *i = malloc(sizeof(mpc_input_t));
+
+    i->filename = malloc(strlen(filename) + 1);
+    strcpy(i->filename, filename);
+
+    i->type = MPC_INPUT_PIPE;
+    i->state = mpc_state_new();
+
+    i->string = NULL;
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_num = 0;
+    i->buffer_slots = 0;
     i->file = pipe;
 
     i->suppress = 0;
@@ -195,6 +817,11 @@ static mpc_input_t *mpc_input_new_pipe(const char *filename, FILE *pipe)
     i->mem_index = 0;
     memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+    i->memo = NULL;
+    i->arena = NULL;
+    i->slices = 0;
+    i->mapped = 0;
+
     return i;
 
 }
@@ -211,6 +838,9 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file)
 
     i->string = NULL;
     i->buffer = NULL;
+    i->buffer_pos = 0;
+    i->buffer_num = 0;
+    i->buffer_slots = 0;
     i->file = file;
 
     i->suppress = 0;
@@ -224,20 +854,47 @@ static mpc_input_t *mpc_input_new_file(const char *filename, FILE *file)
     i->mem_index = 0;
     memset(i->mem_full, 0, sizeof(char) * MPC_INPUT_MEM_NUM);
 
+    i->memo = NULL;
+    i->arena = NULL;
+    i->slices = 0;
+    i->mapped = 0;
+
     return i;
 }
 
+static void mpc_memo_clear(mpc_memo_slot_t *slot);
+
 static void mpc_input_delete(mpc_input_t *i)
 {
+    int j;
 
     free(i->filename);
 
-    if (i->type == MPC_INPUT_STRING)
+    if (i->memo)
+    {
+        for (j = 0; j < MPC_INPUT_MEMO_WINDOW; j++)
+        {
+            mpc_memo_clear(&i->memo[j]);
+        }
+        free(i->memo);
+    }
+
+    if (i->arena)
+    {
+        mpc_ast_arena_delete(i->arena);
+    }
+
+    if (i->type == MPC_INPUT_STRING && i->string)
     {
-        free(i->string);
+        mpc_text_free(i->string, i->mapped);
     }
     if (i->type == MPC_INPUT_PIPE)
     {
+        /* Give back what was read ahead of the cursor */
+        for (j = (int)(i->buffer_pos + i->buffer_num - i->state.pos) - 1; j >= 0; j--)
+        {
+            ungetc(i->buffer[i->state.pos - i->buffer_pos + j], i->file);
+        }
         free(i->buffer);
     }
 
@@ -320,9 +977,22 @@ static void *mpc_realloc(mpc_input_t *i, void *p, size_t n)
     return p;
 }
 
+static mpc_ast_arena_t *mpc_input_arena(mpc_input_t *i)
+{
+    if (i->arena == NULL)
+    {
+        i->arena = mpc_ast_arena_new();
+    }
+    return i->arena;
+}
+
 static void *mpc_export(mpc_input_t *i, void *p)
 {
     char *q = NULL;
+    if (i->arena && mpc_ast_arena_owns(i->arena, p))
+    {
+        return mpc_ast_arena_copy(NULL, p);
+    }
     if (!mpc_mem_ptr(i, p))
     {
         return p;
@@ -371,16 +1041,10 @@ static void mpc_input_mark(mpc_input_t *i)
     i->marks[i->marks_num-1] = i->state;
     i->lasts[i->marks_num-1] = i->last;
 
-    if (i->type == MPC_INPUT_PIPE && i->marks_num == 1)
-    {
-        i->buffer = calloc(1, 1);
-    }
-
 }
 
 static void mpc_input_unmark(mpc_input_t *i)
 {
-    int j;
 
     if (i->backtrack < 1)
     {
@@ -399,15 +1063,6 @@ static void mpc_input_unmark(mpc_input_t *i)
         i->lasts = realloc(i->lasts, sizeof(char) * i->marks_slots);
     }
 
-    if (i->type == MPC_INPUT_PIPE && i->marks_num == 0)
-    {
-        for (j = strlen(i->buffer) - 1; j >= 0; j--)
-            ungetc(i->buffer[j], i->file);
-
-        free(i->buffer);
-        i->buffer = NULL;
-    }
-
 }
 
 static void mpc_input_rewind(mpc_input_t *i)
@@ -429,14 +1084,56 @@ static void mpc_input_rewind(mpc_input_t *i)
     mpc_input_unmark(i);
 }
 
-static int mpc_input_buffer_in_range(mpc_input_t *i)
-{
-    return i->state.pos < (long)(strlen(i->buffer) + i->marks[0].pos);
-}
-
+/*
+** Returns the character under the cursor of a Pipe,
+** reading more input when the buffer runs out, or
+** NUL at the end of the input. The input before the
+** oldest mark is dropped once it is at least half of
+** the buffer, so moving what remains is amortized.
+*/
 static char mpc_input_buffer_get(mpc_input_t *i)
 {
-    return i->buffer[i->state.pos - i->marks[0].pos];
+    long keep;
+    size_t n;
+    int c;
+
+    if (i->state.pos < i->buffer_pos + (long)i->buffer_num)
+    {
+        return i->buffer[i->state.pos - i->buffer_pos];
+    }
+
+    keep = i->marks_num > 0 ? i->marks[0].pos : i->state.pos;
+    if (keep > i->buffer_pos && (size_t)(keep - i->buffer_pos) * 2 >= i->buffer_num)
+    {
+        i->buffer_num -= keep - i->buffer_pos;
+        memmove(i->buffer, i->buffer + (keep - i->buffer_pos), i->buffer_num);
+        i->buffer_pos = keep;
+    }
+
+    if (i->buffer_num + MPC_INPUT_PIPE_CHUNK + 1 > i->buffer_slots)
+    {
+        i->buffer_slots = i->buffer_slots * 2 > i->buffer_num + MPC_INPUT_PIPE_CHUNK + 1
+                          ? i->buffer_slots * 2 : i->buffer_num + MPC_INPUT_PIPE_CHUNK + 1;
+        i->buffer = realloc(i->buffer, i->buffer_slots);
+    }
+
+    /*
+    ** Reads stop at a newline, so interactive input is parsed as it arrives.
+    ** Bytes are counted as they are read, so a NUL in the input is kept just
+    ** as it is when reading from a file.
+    */
+    n = 0;
+    while (n < MPC_INPUT_PIPE_CHUNK && (c = getc(i->file)) != EOF)
+    {
+        i->buffer[i->buffer_num + n++] = (char)c;
+        if (c == '\n')
+        {
+            break;
+        }
+    }
+    i->buffer_num += n;
+
+    return n ? i->buffer[i->state.pos - i->buffer_pos] : '\0';
 }
 
 static char mpc_input_getc(mpc_input_t *i)
@@ -453,23 +1150,7 @@ static char mpc_input_getc(mpc_input_t *i)
         c = fgetc(i->file);
         return c;
     case MPC_INPUT_PIPE:
-
-        if (!i->buffer)
-        {
-            c = getc(i->file);
-            return c;
-        }
-
-        if (i->buffer && mpc_input_buffer_in_range(i))
-        {
-            c = mpc_input_buffer_get(i);
-            return c;
-        }
-        else
-        {
-            c = getc(i->file);
-            return c;
-        }
+        return mpc_input_buffer_get(i);
 
     default:
         return c;
@@ -497,32 +1178,7 @@ static char mpc_input_peekc(mpc_input_t *i)
         return c;
 
     case MPC_INPUT_PIPE:
-
-        if (!i->buffer)
-        {
-            c = getc(i->file);
-            if (feof(i->file))
-            {
-                return '\0';
-            }
-            ungetc(c, i->file);
-            return c;
-        }
-
-        if (i->buffer && mpc_input_buffer_in_range(i))
-        {
-            return mpc_input_buffer_get(i);
-        }
-        else
-        {
-            c = getc(i->file);
-            if (feof(i->file))
-            {
-                return '\0';
-            }
-            ungetc(c, i->file);
-            return c;
-        }
+        return mpc_input_buffer_get(i);
 
     default:
         return c;
@@ -549,43 +1205,18 @@ static int mpc_input_failure(mpc_input_t *i, char c)
         {
             break;
         }
-    case MPC_INPUT_PIPE:
-    {
-
-        if (!i->buffer)
-        {
-            ungetc(c, i->file);
-            break;
-        }
-
-        if (i->buffer && mpc_input_buffer_in_range(i))
-        {
-            break;
-        }
-        else
-        {
-            ungetc(c, i->file);
-        }
-    }
     default:
     {
         break;
     }
     }
+    (void)c;
     return 0;
 }
 
 static int mpc_input_success(mpc_input_t *i, char c, char **o)
 {
 
-    if (i->type == MPC_INPUT_PIPE
-            &&  i->buffer && !mpc_input_buffer_in_range(i))
-    {
-        i->buffer = realloc(i->buffer, strlen(i->buffer) + 2);
-        i->buffer[strlen(i->buffer) + 1] = '\0';
-        i->buffer[strlen(i->buffer) + 0] = c;
-    }
-
     i->last = c;
     i->state.pos++;
     i->state.col++;
@@ -1183,7 +1814,9 @@ enum
     MPC_TYPE_SOI        = 27,
     MPC_TYPE_EOI        = 28,
 
-    MPC_TYPE_SEPBY1     = 29
+    MPC_TYPE_SEPBY1     = 29,
+
+    MPC_TYPE_DFA        = 30
 };
 
 typedef struct
@@ -1265,9 +1898,19 @@ typedef struct
     mpc_dtor_t dx;
 } mpc_pdata_repeat_t;
 typedef struct
+{
+    long generation;
+    int *bounds;
+    char *skip;
+    char *seen;
+    mpc_err_t **sides;
+    mpc_err_t **errors;
+} mpc_dispatch_t;
+typedef struct
 {
     int n;
     mpc_parser_t **xs;
+    mpc_dispatch_t *dispatch;
 } mpc_pdata_or_t;
 typedef struct
 {
@@ -1284,6 +1927,32 @@ typedef struct
     mpc_parser_t *sep;
 } mpc_pdata_sepby1;
 
+typedef struct
+{
+    char type;
+    int min;
+    int max;
+    char *m;
+    unsigned char set[32];
+} mpc_dfa_item_t;
+typedef struct
+{
+    int height;
+    int rewind;
+    int items_num;
+    mpc_dfa_item_t *items;
+    int states_num;
+    int *item;
+    int *count;
+    short *next;
+    unsigned char *from;
+} mpc_dfa_t;
+typedef struct
+{
+    mpc_parser_t *x;
+    mpc_dfa_t *d;
+} mpc_pdata_dfa_t;
+
 typedef union
 {
     mpc_pdata_fail_t fail;
@@ -1304,6 +1973,7 @@ typedef union
     mpc_pdata_and_t and;
     mpc_pdata_or_t or;
     mpc_pdata_sepby1 sepby1;
+    mpc_pdata_dfa_t dfa;
 } mpc_pdata_t;
 
 struct mpc_parser_t
@@ -1312,6 +1982,9 @@ struct mpc_parser_t
     mpc_pdata_t data;
     char type;
     char retained;
+    char memo;
+    char slices;
+    char analysed;
 };
 
 static mpc_val_t *mpcf_input_nth_free(mpc_input_t *i, int n, mpc_val_t **xs, int x)
@@ -1371,6 +2044,8 @@ static mpc_val_t *mpcf_input_state_ast(mpc_input_t *i, int n, mpc_val_t **xs)
     return a;
 }
 
+static mpc_val_t *mpc_ast_fold(mpc_ast_arena_t *arena, int n, mpc_val_t **xs);
+
 static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t **xs)
 {
     int j;
@@ -1402,95 +2077,886 @@ static mpc_val_t *mpc_parse_fold(mpc_input_t *i, mpc_fold_t f, int n, mpc_val_t
     {
         return mpcf_input_trd_free(i, n, xs);
     }
-    if (f == mpcf_strfold)
+    if (f == mpcf_strfold)
+    {
+        return mpcf_input_strfold(i, n, xs);
+    }
+    if (f == mpcf_state_ast)
+    {
+        return mpcf_input_state_ast(i, n, xs);
+    }
+    if (f == mpcf_fold_ast)
+    {
+        return mpc_ast_fold(mpc_input_arena(i), n, xs);
+    }
+    for (j = 0; j < n; j++)
+    {
+        xs[j] = mpc_export(i, xs[j]);
+    }
+    return f(j, xs);
+}
+
+static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x)
+{
+    mpc_free(i, x);
+    return NULL;
+}
+
+/*
+** Finds where the text c was parsed from. It ends
+** where the input is now, or before the whitespace
+** a token parser skipped after it.
+*/
+static char *mpc_input_slice(mpc_input_t *i, const char *c, size_t len)
+{
+    long end = i->state.pos;
+    while (end >= (long)len)
+    {
+        if (memcmp(i->string + end - len, c, len) == 0)
+        {
+            return i->string + end - len;
+        }
+        if (!isspace((unsigned char)i->string[end-1]))
+        {
+            break;
+        }
+        end--;
+    }
+    return NULL;
+}
+
+static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c)
+{
+    size_t len = strlen(c);
+    char *s = i->slices ? mpc_input_slice(i, c, len) : NULL;
+    mpc_ast_t *a;
+    if (s)
+    {
+        a = mpc_ast_arena_node(mpc_input_arena(i), "", "", 0);
+        a->contents = s;
+        a->contents_len = len;
+    }
+    else
+    {
+        a = mpc_ast_arena_node(mpc_input_arena(i), "", c, len);
+    }
+    mpc_free(i, c);
+    return a;
+}
+
+static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x)
+{
+    if (f == mpcf_free)
+    {
+        return mpcf_input_free(i, x);
+    }
+    if (f == mpcf_str_ast)
+    {
+        return mpcf_input_str_ast(i, x);
+    }
+    if (f == (mpc_apply_t)mpc_ast_add_root)
+    {
+        return mpc_ast_add_root(x);
+    }
+    return f(mpc_export(i, x));
+}
+
+static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d)
+{
+    if (f == (mpc_apply_to_t)mpc_ast_tag
+            || f == (mpc_apply_to_t)mpc_ast_add_tag
+            || f == (mpc_apply_to_t)mpc_ast_add_root_tag)
+    {
+        return f(x, d);
+    }
+    return f(mpc_export(i, x), d);
+}
+
+static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x)
+{
+    if (d == free)
+    {
+        mpc_free(i, x);
+        return;
+    }
+    if (d == (mpc_dtor_t)mpc_ast_delete)
+    {
+        mpc_ast_delete(x);
+        return;
+    }
+    d(mpc_export(i, x));
+}
+
+enum
+{
+    MPC_PARSE_STACK_MIN = 4
+};
+
+#define MPC_SUCCESS(x) r->output = x; return 1
+#define MPC_FAILURE(x) r->error = x; return 0
+#define MPC_PRIMITIVE(x) \
+  if (x) { MPC_SUCCESS(r->output); } \
+  else { MPC_FAILURE(NULL); }
+
+#define MPC_MAX_RECURSION_DEPTH 1000
+
+static mpc_result_t *mpc_grow_results(mpc_input_t *i, int j, mpc_result_t *results_stk, mpc_result_t *results)
+{
+    mpc_result_t *tmp_results = results;
+
+    if (j == MPC_PARSE_STACK_MIN)
+    {
+        int results_slots = j + j / 2;
+        tmp_results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
+        memcpy(tmp_results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+    }
+    else if (j >= MPC_PARSE_STACK_MIN)
+    {
+        int results_slots = j + j / 2;
+        tmp_results = mpc_realloc(i, tmp_results, sizeof(mpc_result_t) * results_slots);
+    }
+
+    return tmp_results;
+}
+
+/*
+** Packrat Parsing
+**
+** Parsers marked for memoization remember, per
+** input position, how they ended: failures the
+** first time, successes from the second request
+** on, so the copying only costs anything where a
+** parse would otherwise be repeated. A replay puts
+** the input where the original parse left it and
+** merges in the same errors it produced, so output
+** and error messages are unchanged. Outputs must
+** be mpc_ast_t, which holds for mpca grammars, and
+** only string inputs, which can be jumped around
+** in freely, are memoized.
+*/
+
+static mpc_err_t *mpc_err_copy(mpc_err_t *x)
+{
+    int j;
+    mpc_err_t *y;
+
+    if (x == NULL)
+    {
+        return NULL;
+    }
+
+    y = malloc(sizeof(mpc_err_t));
+    y->state = x->state;
+    y->expected_num = x->expected_num;
+    y->received = x->received;
+    y->filename = malloc(strlen(x->filename) + 1);
+    strcpy(y->filename, x->filename);
+    y->failure = NULL;
+    if (x->failure)
+    {
+        y->failure = malloc(strlen(x->failure) + 1);
+        strcpy(y->failure, x->failure);
+    }
+    y->expected = x->expected_num ? malloc(sizeof(char*) * x->expected_num) : NULL;
+    for (j = 0; j < x->expected_num; j++)
+    {
+        y->expected[j] = malloc(strlen(x->expected[j]) + 1);
+        strcpy(y->expected[j], x->expected[j]);
+    }
+    return y;
+}
+
+/*
+** Copy the top of a tree for the memo, sharing the rest. Folding and
+** tagging a result only ever change its root and the tags of the root's
+** children, so the nodes below those are never changed once built and one
+** copy of them serves the memo entry and every replay of it.
+*/
+static mpc_ast_t *mpc_ast_arena_share(mpc_ast_arena_t *a, mpc_ast_t *n, int depth)
+{
+    int j;
+    mpc_ast_t *m;
+
+    if (n == NULL || n->arena != a)
+    {
+        return mpc_ast_arena_copy(a, n);
+    }
+    if (depth == 0)
+    {
+        return n;
+    }
+
+    m = mpc_ast_arena_alloc(a, sizeof(mpc_ast_t));
+    *m = *n;
+    m->children_slots = n->children_num;
+    m->children = mpc_ast_arena_children(a, n->children_num);
+    for (j = 0; j < n->children_num; j++)
+    {
+        m->children[j] = mpc_ast_arena_share(a, n->children[j], depth - 1);
+    }
+    return m;
+}
+
+static void mpc_memo_release(mpc_memo_t *m)
+{
+    if (m->output)
+    {
+        mpc_ast_delete(m->output);
+    }
+    if (m->error)
+    {
+        mpc_err_delete(m->error);
+    }
+    if (m->side)
+    {
+        mpc_err_delete(m->side);
+    }
+    m->output = NULL;
+    m->error = NULL;
+    m->side = NULL;
+}
+
+static void mpc_memo_clear(mpc_memo_slot_t *slot)
+{
+    mpc_memo_t *m, *next;
+
+    for (m = slot->entries; m; m = next)
+    {
+        next = m->next;
+        mpc_memo_release(m);
+        free(m);
+    }
+
+    slot->entries = NULL;
+}
+
+static mpc_memo_t *mpc_memo_find(mpc_input_t *i, mpc_parser_t *p, mpc_state_t *start, int suppress)
+{
+    mpc_memo_slot_t *slot = &i->memo[start->pos % MPC_INPUT_MEMO_WINDOW];
+    mpc_memo_t *m;
+
+    if (slot->pos != start->pos)
+    {
+        return NULL;
+    }
+
+    for (m = slot->entries; m; m = m->next)
+    {
+        if (m->parser == p && m->term == start->term && m->suppress == suppress)
+        {
+            return m;
+        }
+    }
+
+    return NULL;
+}
+
+static mpc_memo_t *mpc_memo_add(mpc_input_t *i, mpc_parser_t *p, mpc_state_t *start, int suppress)
+{
+    mpc_memo_slot_t *slot = &i->memo[start->pos % MPC_INPUT_MEMO_WINDOW];
+    mpc_memo_t *m;
+
+    if (slot->pos != start->pos)
+    {
+        mpc_memo_clear(slot);
+        slot->pos = start->pos;
+    }
+
+    m = calloc(1, sizeof(mpc_memo_t));
+    m->parser = p;
+    m->term = start->term;
+    m->suppress = suppress;
+    m->next = slot->entries;
+    slot->entries = m;
+    return m;
+}
+
+static int mpc_parse_step(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth);
+
+static int mpc_parse_memo(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth)
+{
+    int j, x, seen;
+    int suppress = i->suppress > 0;
+    mpc_state_t start = i->state;
+    mpc_err_t *side = NULL;
+    mpc_memo_t *m;
+
+    if (i->memo == NULL)
+    {
+        i->memo = malloc(sizeof(mpc_memo_slot_t) * MPC_INPUT_MEMO_WINDOW);
+        for (j = 0; j < MPC_INPUT_MEMO_WINDOW; j++)
+        {
+            i->memo[j].pos = -1;
+            i->memo[j].entries = NULL;
+        }
+    }
+
+    m = mpc_memo_find(i, p, &start, suppress);
+
+    if (m && m->done)
+    {
+        i->state = m->state;
+        i->last = m->last;
+        *e = mpc_err_merge(i, *e, mpc_err_copy(m->side));
+        if (m->success)
+        {
+            r->output = mpc_ast_arena_share(mpc_input_arena(i), m->output, 2);
+            return 1;
+        }
+        r->error = mpc_err_copy(m->error);
+        return 0;
+    }
+
+    seen = m != NULL;
+    if (!seen)
+    {
+        mpc_memo_add(i, p, &start, suppress);
+    }
+
+    x = mpc_parse_step(i, p, r, &side, depth);
+
+    /* Failures reported from the recursion limit depend on the depth, not just the position */
+    if ((!x || seen) && !(!x && r->error && r->error->failure))
+    {
+        m = mpc_memo_find(i, p, &start, suppress);
+        if (!m)
+        {
+            m = mpc_memo_add(i, p, &start, suppress);
+        }
+        /* A left recursive rule finishes again in each enclosing call */
+        mpc_memo_release(m);
+        m->done = 1;
+        m->success = x;
+        m->state = i->state;
+        m->last = i->last;
+        m->output = x ? mpc_ast_arena_share(mpc_input_arena(i), r->output, 2) : NULL;
+        m->error = x ? NULL : mpc_err_copy(r->error);
+        m->side = mpc_err_copy(side);
+    }
+
+    *e = mpc_err_merge(i, *e, side);
+    return x;
+}
+
+static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth)
+{
+    if (p->memo && i->type == MPC_INPUT_STRING && i->backtrack > 0
+            && depth < MPC_MAX_RECURSION_DEPTH)
+    {
+        return mpc_parse_memo(i, p, r, e, depth);
+    }
+    return mpc_parse_step(i, p, r, e, depth);
+}
+
+/*
+** Regex Automata
+**
+** A regex made only of single character classes, each optionally
+** followed by '*', '+', '?' or '{n}', is matched by combinators that
+** are greedy and never give back what a repeat consumed. Such a regex
+** is compiled into a table over the input bytes with one state per
+** item and repeat count, which follows the combinators exactly. Errors
+** are rebuilt from the item labels at the positions the combinators
+** would have reported them.
+*/
+
+enum
+{
+    MPC_DFA_MAX_ITEMS  = 255,
+    MPC_DFA_MAX_STATES = 1024
+};
+
+static int mpc_dfa_match(mpc_parser_t *p, char x)
+{
+    switch (p->type)
+    {
+    case MPC_TYPE_ANY:
+        return 1;
+    case MPC_TYPE_SINGLE:
+        return x == p->data.single.x;
+    case MPC_TYPE_RANGE:
+        return x >= p->data.range.x && x <= p->data.range.y;
+    case MPC_TYPE_ONEOF:
+        return strchr(p->data.string.x, x) != 0;
+    case MPC_TYPE_NONEOF:
+        return strchr(p->data.string.x, x) == 0;
+    case MPC_TYPE_SATISFY:
+        return p->data.satisfy.f(x);
+    default:
+        return 0;
+    }
+}
+
+static int mpc_dfa_class(mpc_parser_t *p, unsigned char *set)
+{
+
+    int j, h, height = 0;
+    int c;
+
+    if (p->retained)
+    {
+        return 0;
+    }
+
+    switch (p->type)
+    {
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+        for (c = 1; c < 256; c++)
+        {
+            if (mpc_dfa_match(p, (char)c))
+            {
+                set[c / 8] |= 1 << (c % 8);
+            }
+        }
+        return 1;
+
+    case MPC_TYPE_EXPECT:
+        h = mpc_dfa_class(p->data.expect.x, set);
+        return h ? h + 1 : 0;
+
+    case MPC_TYPE_OR:
+        for (j = 0; j < p->data.or.n; j++)
+        {
+            h = mpc_dfa_class(p->data.or.xs[j], set);
+            if (!h)
+            {
+                return 0;
+            }
+            height = h > height ? h : height;
+        }
+        return height + 1;
+
+    default:
+        return 0;
+    }
+}
+
+static int mpc_dfa_item(mpc_dfa_t *d, mpc_parser_t *p)
+{
+
+    int h;
+    mpc_parser_t *x = p;
+    mpc_dfa_item_t *it;
+
+    if (p->retained || d->items_num == MPC_DFA_MAX_ITEMS)
+    {
+        return 0;
+    }
+
+    d->items = realloc(d->items, sizeof(mpc_dfa_item_t) * (d->items_num + 1));
+    it = &d->items[d->items_num];
+    memset(it, 0, sizeof(mpc_dfa_item_t));
+    it->type = p->type;
+
+    switch (p->type)
+    {
+    case MPC_TYPE_EXPECT:
+        it->min = 1;
+        it->max = 1;
+        break;
+    case MPC_TYPE_MAYBE:
+        if (p->data.not.lf != mpcf_ctor_str)
+        {
+            return 0;
+        }
+        x = p->data.not.x;
+        it->min = 0;
+        it->max = 1;
+        break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+        if (p->data.repeat.f != mpcf_strfold)
+        {
+            return 0;
+        }
+        if (p->type == MPC_TYPE_COUNT && p->data.repeat.n < 1)
+        {
+            return 0;
+        }
+        x = p->data.repeat.x;
+        it->min = p->type == MPC_TYPE_MANY  ? 0 :
+                  p->type == MPC_TYPE_MANY1 ? 1 : p->data.repeat.n;
+        it->max = p->type == MPC_TYPE_COUNT ? p->data.repeat.n : 0;
+        break;
+    default:
+        return 0;
+    }
+
+    /* Only a labelled class reports an error the automaton can rebuild */
+    if (x->type != MPC_TYPE_EXPECT || x->retained)
+    {
+        return 0;
+    }
+
+    h = mpc_dfa_class(x, it->set);
+    if (!h)
+    {
+        return 0;
+    }
+
+    it->m = x->data.expect.m;
+    d->items_num++;
+    return x == p ? h : h + 1;
+}
+
+static int mpc_dfa_items(mpc_dfa_t *d, mpc_parser_t *p)
+{
+
+    int j, h, height = 0;
+    mpc_parser_t *x;
+
+    if (p->type != MPC_TYPE_AND || p->retained)
+    {
+        return mpc_dfa_item(d, p);
+    }
+
+    if (p->data.and.f != mpcf_strfold)
+    {
+        return 0;
+    }
+
+    for (j = 0; j < p->data.and.n; j++)
+    {
+        x = p->data.and.xs[j];
+        if (x->type == MPC_TYPE_LIFT && x->data.lift.lf == mpcf_ctor_str && !x->retained)
+        {
+            h = 1;
+        }
+        else
+        {
+            h = mpc_dfa_items(d, x);
+        }
+        if (!h)
+        {
+            return 0;
+        }
+        height = h > height ? h : height;
+    }
+
+    return height + 1;
+}
+
+static void mpc_dfa_delete(mpc_dfa_t *d)
+{
+    free(d->items);
+    free(d->item);
+    free(d->count);
+    free(d->next);
+    free(d->from);
+    free(d);
+}
+
+static mpc_dfa_t *mpc_dfa_new(mpc_parser_t *x)
+{
+
+    int j, k, s, c, jj, kk, next;
+    int *first;
+    mpc_dfa_item_t *it;
+    mpc_dfa_t *d = calloc(1, sizeof(mpc_dfa_t));
+
+    d->height = mpc_dfa_items(d, x);
+    d->rewind = x->type == MPC_TYPE_AND;
+
+    if (!d->height || d->items_num == 0)
+    {
+        mpc_dfa_delete(d);
+        return NULL;
+    }
+
+    /* A repeat stops counting once it may be left, a bounded item at its maximum */
+    first = malloc(sizeof(int) * (d->items_num + 1));
+    for (j = 0; j < d->items_num; j++)
+    {
+        first[j] = d->states_num;
+        it = &d->items[j];
+        d->states_num += it->max ? it->max : it->min + 1;
+        if (d->states_num >= MPC_DFA_MAX_STATES)
+        {
+            free(first);
+            mpc_dfa_delete(d);
+            return NULL;
+        }
+    }
+    first[d->items_num] = d->states_num;
+    d->states_num++;
+
+    d->item  = malloc(sizeof(int) * d->states_num);
+    d->count = malloc(sizeof(int) * d->states_num);
+    d->next  = malloc(sizeof(short) * d->states_num * 256);
+    d->from  = malloc(d->states_num * 256);
+
+    for (j = 0; j <= d->items_num; j++)
+    {
+        for (s = first[j]; s < (j < d->items_num ? first[j+1] : d->states_num); s++)
+        {
+            d->item[s] = j;
+            d->count[s] = s - first[j];
+        }
+    }
+
+    for (s = 0; s < d->states_num; s++)
+    {
+        for (c = 0; c < 256; c++)
+        {
+
+            next = -1;
+            jj = d->item[s];
+            kk = d->count[s];
+
+            while (c && jj < d->items_num)
+            {
+                it = &d->items[jj];
+                if (it->set[c / 8] & (1 << (c % 8)))
+                {
+                    k = kk + 1;
+                    if (it->max && k == it->max)
+                    {
+                        next = first[jj+1];
+                    }
+                    else
+                    {
+                        next = first[jj] + (!it->max && k > it->min ? it->min : k);
+                    }
+                    break;
+                }
+                if (kk < it->min)
+                {
+                    break;
+                }
+                jj++;
+                kk = 0;
+            }
+
+            d->next[s * 256 + c] = next;
+            d->from[s * 256 + c] = jj;
+        }
+    }
+
+    free(first);
+    return d;
+}
+
+static int mpc_parse_dfa(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth)
+{
+
+    int j, k, s, next;
+    unsigned char c;
+    char last = i->last;
+    mpc_state_t start = i->state;
+    mpc_dfa_t *d = p->data.dfa.d;
+    mpc_dfa_item_t *it;
+    mpc_err_t *err;
+    long n;
+
+    /* Anything the combinators do differently away from a backtracking string input */
+    if (i->type != MPC_INPUT_STRING || i->backtrack < 1
+            || depth + d->height > MPC_MAX_RECURSION_DEPTH)
     {
-        return mpcf_input_strfold(i, n, xs);
+        return mpc_parse_run(i, p->data.dfa.x, r, e, depth);
     }
-    if (f == mpcf_state_ast)
+
+    s = 0;
+    for (;;)
     {
-        return mpcf_input_state_ast(i, n, xs);
+        c = (unsigned char)i->string[i->state.pos];
+        next = d->next[s * 256 + c];
+        if (next < 0)
+        {
+            break;
+        }
+
+        /* Items left behind before this character still report what they expected */
+        for (j = d->item[s]; j < d->from[s * 256 + c]; j++)
+        {
+            *e = mpc_err_merge(i, *e, mpc_err_new(i, d->items[j].m));
+        }
+
+        i->last = c;
+        i->state.pos++;
+        i->state.col++;
+        if (c == '\n')
+        {
+            i->state.col = 0;
+            i->state.row++;
+        }
+        s = next;
     }
-    for (j = 0; j < n; j++)
+
+    for (j = d->item[s], k = d->count[s]; j < d->items_num; j++, k = 0)
     {
-        xs[j] = mpc_export(i, xs[j]);
+        it = &d->items[j];
+        if (k < it->min)
+        {
+            err = mpc_err_new(i, it->m);
+            if (it->type == MPC_TYPE_MANY1)
+            {
+                err = mpc_err_many1(i, err);
+            }
+            if (it->type == MPC_TYPE_COUNT)
+            {
+                err = mpc_err_count(i, err, it->min);
+            }
+            if (d->rewind)
+            {
+                i->state = start;
+                i->last = last;
+            }
+            MPC_FAILURE(err);
+        }
+        *e = mpc_err_merge(i, *e, mpc_err_new(i, it->m));
     }
-    return f(j, xs);
-}
 
-static mpc_val_t *mpcf_input_free(mpc_input_t *i, mpc_val_t *x)
-{
-    mpc_free(i, x);
-    return NULL;
+    n = i->state.pos - start.pos;
+    r->output = mpc_malloc(i, n + 1);
+    memcpy(r->output, i->string + start.pos, n);
+    ((char*)r->output)[n] = '\0';
+    return 1;
 }
 
-static mpc_val_t *mpcf_input_str_ast(mpc_input_t *i, mpc_val_t *c)
+/*
+** Alternative Dispatch
+**
+** mpc_analyse marks the alternatives of an `or` that cannot start with
+** a given next byte. Such an alternative fails without consuming input
+** and what it reports depends only on that byte, so the errors from
+** its first attempt are kept and replayed in place of running it again.
+*/
+
+enum
 {
-    mpc_ast_t *a = mpc_ast_new("", c);
-    mpc_free(i, c);
-    return a;
-}
+    MPC_DISPATCH_UNSEEN  = 0,
+    MPC_DISPATCH_KEPT    = 1,
+    MPC_DISPATCH_REFUSED = 2
+};
 
-static mpc_val_t *mpc_parse_apply(mpc_input_t *i, mpc_apply_t f, mpc_val_t *x)
+/* Bumped whenever an analysed parser is redefined, which retires every dispatch table */
+static long mpc_generation = 0;
+
+static void mpc_dispatch_delete(mpc_dispatch_t *d, int n)
 {
-    if (f == mpcf_free)
+    int j;
+
+    if (d == NULL)
     {
-        return mpcf_input_free(i, x);
+        return;
     }
-    if (f == mpcf_str_ast)
+
+    for (j = 0; j < n * 256; j++)
     {
-        return mpcf_input_str_ast(i, x);
+        if (d->sides[j])
+        {
+            mpc_err_delete(d->sides[j]);
+        }
+        if (d->errors[j])
+        {
+            mpc_err_delete(d->errors[j]);
+        }
     }
-    return f(mpc_export(i, x));
+
+    free(d->bounds);
+    free(d->skip);
+    free(d->seen);
+    free(d->sides);
+    free(d->errors);
+    free(d);
 }
 
-static mpc_val_t *mpc_parse_apply_to(mpc_input_t *i, mpc_apply_to_t f, mpc_val_t *x, mpc_val_t *d)
+static mpc_err_t *mpc_err_replay(mpc_input_t *i, mpc_err_t *x)
 {
-    return f(mpc_export(i, x), d);
+    mpc_err_t *y = mpc_err_copy(x);
+    if (y == NULL)
+    {
+        return NULL;
+    }
+    y->state = i->state;
+    free(y->filename);
+    y->filename = malloc(strlen(i->filename) + 1);
+    strcpy(y->filename, i->filename);
+    return y;
 }
 
-static void mpc_parse_dtor(mpc_input_t *i, mpc_dtor_t d, mpc_val_t *x)
+static int mpc_err_at(mpc_err_t *x, mpc_state_t *s)
 {
-    if (d == free)
+    return x == NULL || x->state.pos == s->pos;
+}
+
+static int mpc_dispatch_slot(mpc_input_t *i, mpc_dispatch_t *d, int j, int depth)
+{
+    int k;
+
+    if (d == NULL || d->generation != mpc_generation
+            || d->bounds[j] < 0 || depth + d->bounds[j] >= MPC_MAX_RECURSION_DEPTH)
     {
-        mpc_free(i, x);
-        return;
+        return -1;
     }
-    d(mpc_export(i, x));
+
+    k = j * 256 + (unsigned char)mpc_input_peekc(i);
+    return d->skip[k] && d->seen[k] != MPC_DISPATCH_REFUSED ? k : -1;
 }
 
-enum
+static int mpc_parse_or_alt(mpc_input_t *i, mpc_parser_t *p, int j, mpc_result_t *r, mpc_err_t **e, int depth)
 {
-    MPC_PARSE_STACK_MIN = 4
-};
 
-#define MPC_SUCCESS(x) r->output = x; return 1
-#define MPC_FAILURE(x) r->error = x; return 0
-#define MPC_PRIMITIVE(x) \
-  if (x) { MPC_SUCCESS(r->output); } \
-  else { MPC_FAILURE(NULL); }
+    mpc_state_t start;
+    mpc_err_t *side = NULL;
+    mpc_dispatch_t *d = p->data.or.dispatch;
+    mpc_parser_t *x = p->data.or.xs[j];
+    int k = mpc_dispatch_slot(i, d, j, depth);
 
-#define MPC_MAX_RECURSION_DEPTH 1000
+    if (k < 0)
+    {
+        if (mpc_parse_run(i, x, r, e, depth+1))
+        {
+            return 1;
+        }
+        *e = mpc_err_merge(i, *e, r->error);
+        return 0;
+    }
 
-static mpc_result_t *mpc_grow_results(mpc_input_t *i, int j, mpc_result_t *results_stk, mpc_result_t *results)
-{
-    mpc_result_t *tmp_results = results;
+    /* Suppressed errors are never created, so there is nothing to report */
+    if (i->suppress)
+    {
+        return 0;
+    }
 
-    if (j == MPC_PARSE_STACK_MIN)
+    if (d->seen[k] == MPC_DISPATCH_KEPT)
     {
-        int results_slots = j + j / 2;
-        tmp_results = mpc_malloc(i, sizeof(mpc_result_t) * results_slots);
-        memcpy(tmp_results, results_stk, sizeof(mpc_result_t) * MPC_PARSE_STACK_MIN);
+        *e = mpc_err_merge(i, *e, mpc_err_replay(i, d->sides[k]));
+        *e = mpc_err_merge(i, *e, mpc_err_replay(i, d->errors[k]));
+        return 0;
     }
-    else if (j >= MPC_PARSE_STACK_MIN)
+
+    start = i->state;
+    if (mpc_parse_run(i, x, r, &side, depth+1))
     {
-        int results_slots = j + j / 2;
-        tmp_results = mpc_realloc(i, tmp_results, sizeof(mpc_result_t) * results_slots);
+        d->seen[k] = MPC_DISPATCH_REFUSED;
+        *e = mpc_err_merge(i, *e, side);
+        return 1;
     }
 
-    return tmp_results;
+    if (i->state.pos == start.pos && mpc_err_at(side, &start) && mpc_err_at(r->error, &start))
+    {
+        d->seen[k] = MPC_DISPATCH_KEPT;
+        d->sides[k] = mpc_err_copy(side);
+        d->errors[k] = mpc_err_copy(r->error);
+    }
+    else
+    {
+        d->seen[k] = MPC_DISPATCH_REFUSED;
+    }
+
+    *e = mpc_err_merge(i, *e, side);
+    *e = mpc_err_merge(i, *e, r->error);
+    return 0;
 }
 
-static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth)
+static int mpc_parse_step(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_err_t **e, int depth)
 {
 
     int j = 0, k = 0;
@@ -1527,6 +2993,8 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
         MPC_PRIMITIVE(mpc_input_soi(i, (char**)&r->output));
     case MPC_TYPE_EOI:
         MPC_PRIMITIVE(mpc_input_eoi(i, (char**)&r->output));
+    case MPC_TYPE_DFA:
+        return mpc_parse_dfa(i, p, r, e, depth);
 
     /* Other parsers */
 
@@ -1805,7 +3273,7 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
 
         for (j = 0; j < p->data.or.n; j++)
         {
-            if (mpc_parse_run(i, p->data.or.xs[j], &results[j], e, depth+1))
+            if (mpc_parse_or_alt(i, p, j, &results[j], e, depth))
             {
                 MPC_SUCCESS(results[j].output;
                             if (p->data.or.n > MPC_PARSE_STACK_MIN)
@@ -1813,10 +3281,6 @@ static int mpc_parse_run(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r, mpc_e
                 mpc_free(i, results);
                 });
             }
-            else
-            {
-                *e = mpc_err_merge(i, *e, results[j].error);
-            }
         }
 
         MPC_FAILURE(NULL;
@@ -1880,10 +3344,22 @@ int mpc_parse_input(mpc_input_t *i, mpc_parser_t *p, mpc_result_t *r)
     int x;
     mpc_err_t *e = mpc_err_fail(i, "Unknown Error");
     e->state = mpc_state_invalid();
+    i->slices = p->slices && i->type == MPC_INPUT_STRING;
     x = mpc_parse_run(i, p, r, &e, 0);
     if (x)
     {
         mpc_err_delete_internal(i, e);
+        if (i->arena && mpc_ast_arena_owns(i->arena, r->output))
+        {
+            i->arena->root = r->output;
+            if (i->slices)
+            {
+                i->arena->text = i->string;
+                i->arena->text_mapped = i->mapped;
+                i->string = NULL;
+            }
+            i->arena = NULL;
+        }
         r->output = mpc_export(i, r->output);
     }
     else
@@ -1933,6 +3409,7 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r)
 {
 
     FILE *f = fopen(filename, "rb");
+    mpc_input_t *i;
     int res;
 
     if (f == NULL)
@@ -1942,11 +3419,69 @@ int mpc_parse_contents(const char *filename, mpc_parser_t *p, mpc_result_t *r)
         return 0;
     }
 
-    res = mpc_parse_file(filename, f, p, r);
+    /* Files that cannot be mapped or seeked, such as named pipes, are read as a Pipe */
+    i = mpc_input_new_map(filename, f);
+    if (i == NULL)
+    {
+        res = fseek(f, 0, SEEK_CUR) == 0
+              ? mpc_parse_file(filename, f, p, r)
+              : mpc_parse_pipe(filename, f, p, r);
+        fclose(f);
+        return res;
+    }
+
     fclose(f);
+    res = mpc_parse_input(i, p, r);
+    mpc_input_delete(i);
     return res;
 }
 
+/*
+** A Stream parses one result after another from
+** the same file or pipe. It reads through a Pipe
+** input that lives across the parses, so positions
+** carry on from one result to the next and the
+** buffer only holds input not yet consumed. The
+** file is left open when the Stream is deleted.
+*/
+
+struct mpc_stream_t
+{
+    mpc_input_t *input;
+};
+
+mpc_stream_t *mpc_stream_new(const char *filename, FILE *file)
+{
+    mpc_stream_t *s = malloc(sizeof(mpc_stream_t));
+    s->input = mpc_input_new_pipe(filename, file);
+    return s;
+}
+
+void mpc_stream_delete(mpc_stream_t *s)
+{
+    mpc_input_delete(s->input);
+    free(s);
+}
+
+int mpc_stream_done(mpc_stream_t *s)
+{
+    return mpc_input_terminated(s->input);
+}
+
+int mpc_parse_stream(mpc_stream_t *s, mpc_parser_t *p, mpc_result_t *r)
+{
+    int x = mpc_parse_input(s->input, p, r);
+
+    /* Nodes of abandoned alternatives would otherwise pile up across parses */
+    if (s->input->arena)
+    {
+        mpc_ast_arena_delete(s->input->arena);
+        s->input->arena = NULL;
+    }
+
+    return x;
+}
+
 /*
 ** Building a Parser
 */
@@ -1962,6 +3497,7 @@ static void mpc_undefine_or(mpc_parser_t *p)
         mpc_undefine_unretained(p->data.or.xs[i], 0);
     }
     free(p->data.or.xs);
+    mpc_dispatch_delete(p->data.or.dispatch, p->data.or.n);
 
 }
 
@@ -2047,6 +3583,11 @@ static void mpc_undefine_unretained(mpc_parser_t *p, int force)
         free(p->data.check_with.e);
         break;
 
+    case MPC_TYPE_DFA:
+        mpc_undefine_unretained(p->data.dfa.x, 0);
+        mpc_dfa_delete(p->data.dfa.d);
+        break;
+
     default:
         break;
     }
@@ -2071,6 +3612,7 @@ void mpc_delete(mpc_parser_t *p)
 
         free(p->name);
         free(p);
+        mpc_tags.parsers--;
 
     }
     else
@@ -2099,6 +3641,8 @@ mpc_parser_t *mpc_new(const char *name)
     p->retained = 1;
     p->name = realloc(p->name, strlen(name) + 1);
     strcpy(p->name, name);
+    mpc_tag_id(name);
+    mpc_tags.parsers++;
     return p;
 }
 
@@ -2171,6 +3715,7 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a)
         break;
 
     case MPC_TYPE_OR:
+        p->data.or.dispatch = NULL;
         p->data.or.xs = malloc(a->data.or.n * sizeof(mpc_parser_t*));
         for (i = 0; i < a->data.or.n; i++)
         {
@@ -2201,6 +3746,11 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a)
         strcpy(p->data.check_with.e, a->data.check_with.e);
         break;
 
+    case MPC_TYPE_DFA:
+        p->data.dfa.x = mpc_copy(a->data.dfa.x);
+        p->data.dfa.d = mpc_dfa_new(p->data.dfa.x);
+        break;
+
     default:
         break;
     }
@@ -2211,6 +3761,10 @@ mpc_parser_t *mpc_copy(mpc_parser_t *a)
 
 mpc_parser_t *mpc_undefine(mpc_parser_t *p)
 {
+    if (p->analysed)
+    {
+        mpc_generation++;
+    }
     mpc_undefine_unretained(p, 1);
     p->type = MPC_TYPE_UNDEFINED;
     return p;
@@ -2219,6 +3773,11 @@ mpc_parser_t *mpc_undefine(mpc_parser_t *p)
 mpc_parser_t *mpc_define(mpc_parser_t *p, mpc_parser_t *a)
 {
 
+    if (p->analysed)
+    {
+        mpc_generation++;
+    }
+
     if (p->retained)
     {
         p->type = a->type;
@@ -2258,6 +3817,11 @@ void mpc_cleanup(int n, ...)
     va_end(va);
 
     free(list);
+
+    if (mpc_tags.parsers == 0)
+    {
+        mpc_tags_free();
+    }
 }
 
 mpc_parser_t *mpc_pass(void)
@@ -3297,6 +4861,21 @@ static mpc_val_t *mpcf_re_range(mpc_val_t *x)
     return out;
 }
 
+static mpc_parser_t *mpc_dfa_compile(mpc_parser_t *x)
+{
+    mpc_parser_t *p;
+    mpc_dfa_t *d = mpc_dfa_new(x);
+    if (d == NULL)
+    {
+        return x;
+    }
+    p = mpc_undefined();
+    p->type = MPC_TYPE_DFA;
+    p->data.dfa.x = x;
+    p->data.dfa.d = d;
+    return p;
+}
+
 mpc_parser_t *mpc_re(const char *re)
 {
     return mpc_re_mode(re, MPC_RE_DEFAULT);
@@ -3367,7 +4946,7 @@ mpc_parser_t *mpc_re_mode(const char *re, int mode)
 
     mpc_optimise(r.output);
 
-    return r.output;
+    return mpc_dfa_compile(r.output);
 
 }
 
@@ -3836,6 +5415,10 @@ static void mpc_print_unretained(mpc_parser_t *p, int force)
         free(s);
     }
 
+    if (p->type == MPC_TYPE_DFA)
+    {
+        mpc_print_unretained(p->data.dfa.x, 0);
+    }
     if (p->type == MPC_TYPE_APPLY)
     {
         mpc_print_unretained(p->data.apply.x, 0);
@@ -4027,6 +5610,15 @@ void mpc_ast_delete(mpc_ast_t *a)
         return;
     }
 
+    if (a->arena)
+    {
+        if (a->arena->root == a)
+        {
+            mpc_ast_arena_delete(a->arena);
+        }
+        return;
+    }
+
     for (i = 0; i < a->children_num; i++)
     {
         mpc_ast_delete(a->children[i]);
@@ -4041,6 +5633,10 @@ void mpc_ast_delete(mpc_ast_t *a)
 
 static void mpc_ast_delete_no_children(mpc_ast_t *a)
 {
+    if (a->arena)
+    {
+        return;
+    }
     free(a->children);
     free(a->tag);
     free(a->contents);
@@ -4055,13 +5651,16 @@ mpc_ast_t *mpc_ast_new(const char *tag, const char *contents)
     a->tag = malloc(strlen(tag) + 1);
     strcpy(a->tag, tag);
 
-    a->contents = malloc(strlen(contents) + 1);
+    a->contents_len = strlen(contents);
+    a->contents = malloc(a->contents_len + 1);
     strcpy(a->contents, contents);
 
     a->state = mpc_state_new();
 
     a->children_num = 0;
+    a->children_slots = 0;
     a->children = NULL;
+    a->arena = NULL;
     return a;
 
 }
@@ -4104,7 +5703,7 @@ mpc_ast_t *mpc_ast_add_root(mpc_ast_t *a)
         return a;
     }
 
-    r = mpc_ast_new(">", "");
+    r = mpc_ast_arena_node(a->arena && a->arena->root == NULL ? a->arena : NULL, ">", "", 0);
     mpc_ast_add_child(r, a);
     return r;
 }
@@ -4118,7 +5717,8 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b)
     {
         return 0;
     }
-    if (strcmp(a->contents, b->contents) != 0)
+    if (a->contents_len != b->contents_len
+            || memcmp(a->contents, b->contents, a->contents_len) != 0)
     {
         return 0;
     }
@@ -4140,6 +5740,24 @@ int mpc_ast_eq(mpc_ast_t *a, mpc_ast_t *b)
 
 mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a)
 {
+    mpc_ast_t **children;
+    if (r->arena)
+    {
+        /* Arena arrays are never freed on their own, so grow them geometrically */
+        if (r->children_num == r->children_slots)
+        {
+            r->children_slots = r->children_slots ? r->children_slots * 2 : MPC_AST_ARENA_CHILDREN_MIN;
+            children = mpc_ast_arena_children(r->arena, r->children_slots);
+            if (r->children_num)
+            {
+                memcpy(children, r->children, sizeof(mpc_ast_t*) * r->children_num);
+            }
+            r->children = children;
+        }
+        r->children[r->children_num++] = a;
+        mpc_ast_arena_adopt(r->arena, a);
+        return r;
+    }
     r->children_num++;
     r->children = realloc(r->children, sizeof(mpc_ast_t*) * r->children_num);
     r->children[r->children_num-1] = a;
@@ -4148,10 +5766,21 @@ mpc_ast_t *mpc_ast_add_child(mpc_ast_t *r, mpc_ast_t *a)
 
 mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t)
 {
+    char *s;
     if (a == NULL)
     {
         return a;
     }
+    if (a->arena)
+    {
+        s = malloc(strlen(t) + 1 + strlen(a->tag) + 1);
+        strcpy(s, t);
+        strcat(s, "|");
+        strcat(s, a->tag);
+        a->tag = mpc_ast_arena_intern(a->arena, s);
+        free(s);
+        return a;
+    }
     a->tag = realloc(a->tag, strlen(t) + 1 + strlen(a->tag) + 1);
     memmove(a->tag + strlen(t) + 1, a->tag, strlen(a->tag)+1);
     memmove(a->tag, t, strlen(t));
@@ -4161,10 +5790,20 @@ mpc_ast_t *mpc_ast_add_tag(mpc_ast_t *a, const char *t)
 
 mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t)
 {
+    char *s;
     if (a == NULL)
     {
         return a;
     }
+    if (a->arena)
+    {
+        s = malloc((strlen(t)-1) + strlen(a->tag) + 1);
+        memcpy(s, t, strlen(t)-1);
+        strcpy(s + (strlen(t)-1), a->tag);
+        a->tag = mpc_ast_arena_intern(a->arena, s);
+        free(s);
+        return a;
+    }
     a->tag = realloc(a->tag, (strlen(t)-1) + strlen(a->tag) + 1);
     memmove(a->tag + (strlen(t)-1), a->tag, strlen(a->tag)+1);
     memmove(a->tag, t, (strlen(t)-1));
@@ -4173,11 +5812,58 @@ mpc_ast_t *mpc_ast_add_root_tag(mpc_ast_t *a, const char *t)
 
 mpc_ast_t *mpc_ast_tag(mpc_ast_t *a, const char *t)
 {
+    if (a->arena)
+    {
+        a->tag = mpc_ast_arena_intern(a->arena, t);
+        return a;
+    }
     a->tag = realloc(a->tag, strlen(t) + 1);
     strcpy(a->tag, t);
     return a;
 }
 
+int mpc_ast_tagged(mpc_ast_t *a, int id)
+{
+    mpc_ast_tag_t *t;
+    const char *x, *y, *name;
+
+    if (id >= 0 && id < mpc_tags.num)
+    {
+        name = mpc_tags.names[id];
+    }
+    else if (id >= 0 && id < 4)
+    {
+        name = mpc_tags_fixed[id];
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (a->arena)
+    {
+        t = (mpc_ast_tag_t*)(a->tag - sizeof(mpc_ast_tag_t));
+        if (t->ids_num >= 0)
+        {
+            return id / 8 < t->ids_num && (t->ids[id / 8] >> (id % 8)) & 1;
+        }
+    }
+
+    for (x = a->tag; ; x = y + 1)
+    {
+        y = strchr(x, '|');
+        y = y ? y : x + strlen(x);
+        if (strncmp(name, x, y - x) == 0 && name[y - x] == '\0')
+        {
+            return 1;
+        }
+        if (*y == '\0')
+        {
+            return 0;
+        }
+    }
+}
+
 mpc_ast_t *mpc_ast_state(mpc_ast_t *a, mpc_state_t s)
 {
     if (a == NULL)
@@ -4204,12 +5890,12 @@ static void mpc_ast_print_depth(mpc_ast_t *a, int d, FILE *fp)
         fprintf(fp, "  ");
     }
 
-    if (strlen(a->contents))
+    if (a->contents_len)
     {
-        fprintf(fp, "%s:%lu:%lu '%s'\n", a->tag,
+        fprintf(fp, "%s:%lu:%lu '%.*s'\n", a->tag,
                 (long unsigned int)(a->state.row+1),
                 (long unsigned int)(a->state.col+1),
-                a->contents);
+                (int)a->contents_len, a->contents);
     }
     else
     {
@@ -4418,12 +6104,12 @@ void mpc_ast_traverse_free(mpc_ast_trav_t **trav)
     }
 }
 
-mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs)
+static mpc_val_t *mpc_ast_fold(mpc_ast_arena_t *arena, int n, mpc_val_t **xs)
 {
 
-    int i, j;
+    int i, j, k;
     mpc_ast_t** as = (mpc_ast_t**)xs;
-    mpc_ast_t *r;
+    mpc_ast_t *r, *c;
 
     if (n == 0)
     {
@@ -4442,9 +6128,31 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs)
         return xs[1];
     }
 
-    r = mpc_ast_new(">", "");
+    r = mpc_ast_arena_node(arena, ">", "", 0);
+
+    for (i = 0; i < n; i++)
+    {
+
+        if (as[i] == NULL)
+        {
+            continue;
+        }
+
+        /* Trees made by user functions are moved into the arena */
+        if (arena && as[i]->arena != arena)
+        {
+            c = as[i];
+            as[i] = mpc_ast_arena_copy(arena, c);
+            mpc_ast_delete(c);
+        }
+
+        r->children_num += as[i]->children_num >= 2 ? as[i]->children_num : 1;
+    }
+
+    r->children_slots = r->children_num;
+    r->children = mpc_ast_arena_children(arena, r->children_num);
 
-    for (i = 0; i < n; i++)
+    for (i = 0, k = 0; i < n; i++)
     {
 
         if (as[i] == NULL)
@@ -4454,18 +6162,18 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs)
 
         if        (as[i] && as[i]->children_num == 0)
         {
-            mpc_ast_add_child(r, as[i]);
+            r->children[k++] = as[i];
         }
         else if (as[i] && as[i]->children_num == 1)
         {
-            mpc_ast_add_child(r, mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag));
+            r->children[k++] = mpc_ast_add_root_tag(as[i]->children[0], as[i]->tag);
             mpc_ast_delete_no_children(as[i]);
         }
         else if (as[i] && as[i]->children_num >= 2)
         {
             for (j = 0; j < as[i]->children_num; j++)
             {
-                mpc_ast_add_child(r, as[i]->children[j]);
+                r->children[k++] = as[i]->children[j];
             }
             mpc_ast_delete_no_children(as[i]);
         }
@@ -4480,6 +6188,11 @@ mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs)
     return r;
 }
 
+mpc_val_t *mpcf_fold_ast(int n, mpc_val_t **xs)
+{
+    return mpc_ast_fold(NULL, n, xs);
+}
+
 mpc_val_t *mpcf_str_ast(mpc_val_t *c)
 {
     mpc_ast_t *a = mpc_ast_new("", c);
@@ -5013,6 +6726,14 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s)
         {
             stmt->grammar = mpc_predictive(stmt->grammar);
         }
+        if (st->flags & MPCA_LANG_PACKRAT)
+        {
+            left->memo = 1;
+        }
+        if (st->flags & MPCA_LANG_SLICES)
+        {
+            left->slices = 1;
+        }
         if (stmt->name)
         {
             stmt->grammar = mpc_expect(stmt->grammar, stmt->name);
@@ -5030,6 +6751,18 @@ static mpc_val_t *mpca_stmt_list_apply_to(mpc_val_t *x, void *s)
     return NULL;
 }
 
+static void mpca_analyse(mpca_grammar_st_t *st)
+{
+    int i;
+    for (i = 0; i < st->parsers_num; i++)
+    {
+        if (st->parsers[i] && st->parsers[i]->retained)
+        {
+            mpc_analyse(st->parsers[i]);
+        }
+    }
+}
+
 static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st)
 {
 
@@ -5100,6 +6833,11 @@ static mpc_err_t *mpca_lang_st(mpc_input_t *i, mpca_grammar_st_t *st)
 
     mpc_cleanup(6, Lang, Stmt, Grammar, Term, Factor, Base);
 
+    if (e == NULL)
+    {
+        mpca_analyse(st);
+    }
+
     return e;
 }
 
@@ -5224,6 +6962,11 @@ static int mpc_nodecount_unretained(mpc_parser_t* p, int force)
         return 1 + mpc_nodecount_unretained(p->data.expect.x, 0);
     }
 
+    if (p->type == MPC_TYPE_DFA)
+    {
+        return 1 + mpc_nodecount_unretained(p->data.dfa.x, 0);
+    }
+
     if (p->type == MPC_TYPE_APPLY)
     {
         return 1 + mpc_nodecount_unretained(p->data.apply.x, 0);
@@ -5399,6 +7142,9 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force)
             t = p->data.or.xs[p->data.or.n-1];
             n = p->data.or.n;
             m = t->data.or.n;
+            mpc_dispatch_delete(p->data.or.dispatch, n);
+            mpc_dispatch_delete(t->data.or.dispatch, m);
+            p->data.or.dispatch = NULL;
             p->data.or.n = n + m - 1;
             p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
             memmove(p->data.or.xs + n - 1, t->data.or.xs, m * sizeof(mpc_parser_t*));
@@ -5416,6 +7162,9 @@ static void mpc_optimise_unretained(mpc_parser_t *p, int force)
             t = p->data.or.xs[0];
             n = p->data.or.n;
             m = t->data.or.n;
+            mpc_dispatch_delete(p->data.or.dispatch, n);
+            mpc_dispatch_delete(t->data.or.dispatch, m);
+            p->data.or.dispatch = NULL;
             p->data.or.n = n + m - 1;
             p->data.or.xs = realloc(p->data.or.xs, sizeof(mpc_parser_t*) * (n + m -1));
             memmove(p->data.or.xs + m, p->data.or.xs + 1, (n - 1) * sizeof(mpc_parser_t*));
@@ -5573,3 +7322,428 @@ void mpc_optimise(mpc_parser_t *p)
 {
     mpc_optimise_unretained(p, 1);
 }
+
+/*
+** Grammar Analysis
+**
+** Works out which bytes each parser can consume first, whether it can
+** succeed without consuming anything, and how deep it calls before it
+** consumes. Rules may refer to themselves, so this is repeated until
+** nothing changes. Parsers that look at more than the next byte, such
+** as anchors, lookahead and checks, are never skipped. Neither are
+** left recursive ones, which only fail once they reach the maximum
+** recursion depth.
+*/
+
+typedef struct
+{
+    mpc_parser_t *p;
+    int visit;
+    int nullable;
+    int fixed;
+    int bound;
+    unsigned char first[32];
+} mpc_first_t;
+
+typedef struct
+{
+    mpc_first_t *nodes;
+    int size;
+    int num;
+    int pass;
+    int changed;
+} mpc_analysis_t;
+
+static mpc_first_t *mpc_analysis_find(mpc_analysis_t *a, mpc_parser_t *p)
+{
+
+    int j, old;
+    mpc_first_t *nodes;
+    size_t h;
+
+    if (a->num * 2 >= a->size)
+    {
+        old = a->size;
+        nodes = a->nodes;
+        a->size = old ? old * 2 : 64;
+        a->nodes = calloc(a->size, sizeof(mpc_first_t));
+        a->num = 0;
+        for (j = 0; j < old; j++)
+        {
+            if (nodes[j].p)
+            {
+                *mpc_analysis_find(a, nodes[j].p) = nodes[j];
+            }
+        }
+        free(nodes);
+    }
+
+    h = ((size_t)p >> 4) * 2654435761u;
+    for (j = h & (a->size - 1); a->nodes[j].p; j = (j + 1) & (a->size - 1))
+    {
+        if (a->nodes[j].p == p)
+        {
+            return &a->nodes[j];
+        }
+    }
+
+    a->nodes[j].p = p;
+    a->nodes[j].fixed = 1;
+    a->num++;
+    return &a->nodes[j];
+}
+
+static void mpc_first_all(mpc_first_t *f)
+{
+    memset(f->first, 0xFF, sizeof(f->first));
+    f->nullable = 1;
+    f->fixed = 0;
+}
+
+static void mpc_first_union(mpc_first_t *f, mpc_first_t *x)
+{
+    int j;
+    for (j = 0; j < 32; j++)
+    {
+        f->first[j] |= x->first[j];
+    }
+    f->fixed = f->fixed && x->fixed;
+}
+
+static mpc_first_t mpc_analyse_node(mpc_analysis_t *a, mpc_parser_t *p);
+
+static mpc_first_t mpc_analyse_child(mpc_analysis_t *a, mpc_parser_t *p, mpc_first_t *f)
+{
+    mpc_first_t x = mpc_analyse_node(a, p);
+    mpc_first_union(f, &x);
+    return x;
+}
+
+static mpc_first_t mpc_analyse_node(mpc_analysis_t *a, mpc_parser_t *p)
+{
+
+    int j, c;
+    mpc_first_t f, x, *g;
+    mpc_dfa_t *d;
+
+    g = mpc_analysis_find(a, p);
+    if (g->visit == a->pass)
+    {
+        return *g;
+    }
+    g->visit = a->pass;
+
+    if (p->retained)
+    {
+        p->analysed = 1;
+    }
+
+    memset(&f, 0, sizeof(mpc_first_t));
+    f.p = p;
+    f.fixed = 1;
+
+    switch (p->type)
+    {
+
+    case MPC_TYPE_UNDEFINED:
+    case MPC_TYPE_FAIL:
+        break;
+
+    case MPC_TYPE_PASS:
+    case MPC_TYPE_LIFT:
+    case MPC_TYPE_LIFT_VAL:
+    case MPC_TYPE_STATE:
+        f.nullable = 1;
+        break;
+
+    case MPC_TYPE_ANY:
+    case MPC_TYPE_SINGLE:
+    case MPC_TYPE_RANGE:
+    case MPC_TYPE_ONEOF:
+    case MPC_TYPE_NONEOF:
+    case MPC_TYPE_SATISFY:
+        for (c = 1; c < 256; c++)
+        {
+            if (mpc_dfa_match(p, (char)c))
+            {
+                f.first[c / 8] |= 1 << (c % 8);
+            }
+        }
+        break;
+
+    case MPC_TYPE_STRING:
+        c = (unsigned char)p->data.string.x[0];
+        f.first[c / 8] |= c ? 1 << (c % 8) : 0;
+        f.nullable = c == 0;
+        break;
+
+    case MPC_TYPE_EXPECT:
+        f.nullable = mpc_analyse_child(a, p->data.expect.x, &f).nullable;
+        break;
+    case MPC_TYPE_APPLY:
+        f.nullable = mpc_analyse_child(a, p->data.apply.x, &f).nullable;
+        break;
+    case MPC_TYPE_APPLY_TO:
+        f.nullable = mpc_analyse_child(a, p->data.apply_to.x, &f).nullable;
+        break;
+    case MPC_TYPE_PREDICT:
+        f.nullable = mpc_analyse_child(a, p->data.predict.x, &f).nullable;
+        break;
+
+    case MPC_TYPE_MAYBE:
+        mpc_analyse_child(a, p->data.not.x, &f);
+        f.nullable = 1;
+        break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+        x = mpc_analyse_child(a, p->data.repeat.x, &f);
+        f.nullable = p->type == MPC_TYPE_MANY
+                     || (p->type == MPC_TYPE_COUNT && p->data.repeat.n <= 0)
+                     || x.nullable;
+        break;
+
+    case MPC_TYPE_OR:
+        f.nullable = p->data.or.n == 0;
+        for (j = 0; j < p->data.or.n; j++)
+        {
+            f.nullable |= mpc_analyse_child(a, p->data.or.xs[j], &f).nullable;
+        }
+        break;
+
+    case MPC_TYPE_AND:
+        f.nullable = 1;
+        for (j = 0; j < p->data.and.n && f.nullable; j++)
+        {
+            f.nullable = mpc_analyse_child(a, p->data.and.xs[j], &f).nullable;
+        }
+        break;
+
+    case MPC_TYPE_DFA:
+        d = p->data.dfa.d;
+        f.nullable = 1;
+        for (j = 0; j < d->items_num && f.nullable; j++)
+        {
+            for (c = 0; c < 32; c++)
+            {
+                f.first[c] |= d->items[j].set[c];
+            }
+            f.nullable = d->items[j].min == 0;
+        }
+        break;
+
+    /* Anchors, lookahead, checks and separators may look past the next byte */
+    case MPC_TYPE_CHECK:
+        mpc_analyse_node(a, p->data.check.x);
+        mpc_first_all(&f);
+        break;
+    case MPC_TYPE_CHECK_WITH:
+        mpc_analyse_node(a, p->data.check_with.x);
+        mpc_first_all(&f);
+        break;
+    case MPC_TYPE_NOT:
+        mpc_analyse_node(a, p->data.not.x);
+        mpc_first_all(&f);
+        break;
+    case MPC_TYPE_SEPBY1:
+        mpc_analyse_node(a, p->data.sepby1.x);
+        mpc_analyse_node(a, p->data.sepby1.sep);
+        mpc_first_all(&f);
+        break;
+    default:
+        mpc_first_all(&f);
+        break;
+    }
+
+    g = mpc_analysis_find(a, p);
+    f.nullable |= g->nullable;
+    f.fixed &= g->fixed;
+    for (j = 0; j < 32; j++)
+    {
+        f.first[j] |= g->first[j];
+    }
+    if (f.nullable != g->nullable || f.fixed != g->fixed
+            || memcmp(f.first, g->first, sizeof(f.first)) != 0)
+    {
+        a->changed = 1;
+    }
+    g->nullable = f.nullable;
+    g->fixed = f.fixed;
+    memcpy(g->first, f.first, sizeof(f.first));
+    return *g;
+}
+
+static int mpc_analyse_bound(mpc_analysis_t *a, mpc_parser_t *p);
+
+static int mpc_analyse_bound_max(mpc_analysis_t *a, mpc_parser_t *p, int bound)
+{
+    int b = mpc_analyse_bound(a, p);
+    return b < 0 || bound < 0 ? -1 : (b > bound ? b : bound);
+}
+
+/* Deepest call made before consuming, or -1 where a parser can call itself without consuming */
+static int mpc_analyse_bound(mpc_analysis_t *a, mpc_parser_t *p)
+{
+
+    int j, b = 0;
+    mpc_first_t *g = mpc_analysis_find(a, p);
+
+    if (g->bound == -2)
+    {
+        g->bound = -1;
+        return -1;
+    }
+    if (g->bound != 0)
+    {
+        return g->bound;
+    }
+    g->bound = -2;
+
+    switch (p->type)
+    {
+    case MPC_TYPE_EXPECT:
+        b = mpc_analyse_bound_max(a, p->data.expect.x, b);
+        break;
+    case MPC_TYPE_APPLY:
+        b = mpc_analyse_bound_max(a, p->data.apply.x, b);
+        break;
+    case MPC_TYPE_APPLY_TO:
+        b = mpc_analyse_bound_max(a, p->data.apply_to.x, b);
+        break;
+    case MPC_TYPE_PREDICT:
+        b = mpc_analyse_bound_max(a, p->data.predict.x, b);
+        break;
+    case MPC_TYPE_CHECK:
+        b = mpc_analyse_bound_max(a, p->data.check.x, b);
+        break;
+    case MPC_TYPE_CHECK_WITH:
+        b = mpc_analyse_bound_max(a, p->data.check_with.x, b);
+        break;
+    case MPC_TYPE_NOT:
+    case MPC_TYPE_MAYBE:
+        b = mpc_analyse_bound_max(a, p->data.not.x, b);
+        break;
+    case MPC_TYPE_MANY:
+    case MPC_TYPE_MANY1:
+    case MPC_TYPE_COUNT:
+        b = mpc_analyse_bound_max(a, p->data.repeat.x, b);
+        break;
+    case MPC_TYPE_SEPBY1:
+        b = mpc_analyse_bound_max(a, p->data.sepby1.x, b);
+        b = mpc_analyse_bound_max(a, p->data.sepby1.sep, b);
+        break;
+    case MPC_TYPE_OR:
+        for (j = 0; j < p->data.or.n; j++)
+        {
+            b = mpc_analyse_bound_max(a, p->data.or.xs[j], b);
+        }
+        break;
+    case MPC_TYPE_AND:
+        for (j = 0; j < p->data.and.n; j++)
+        {
+            b = mpc_analyse_bound_max(a, p->data.and.xs[j], b);
+            if (!mpc_analysis_find(a, p->data.and.xs[j])->nullable)
+            {
+                break;
+            }
+        }
+        break;
+    case MPC_TYPE_DFA:
+        b = p->data.dfa.d->height - 1;
+        break;
+    default:
+        break;
+    }
+
+    g = mpc_analysis_find(a, p);
+    if (g->bound == -1 || b < 0)
+    {
+        g->bound = -1;
+        return -1;
+    }
+    g->bound = b + 1;
+    return g->bound;
+}
+
+static void mpc_analyse_dispatch(mpc_analysis_t *a, mpc_parser_t *p)
+{
+
+    int j, c, any = 0;
+    mpc_first_t *x;
+    mpc_dispatch_t *d;
+
+    mpc_dispatch_delete(p->data.or.dispatch, p->data.or.n);
+    p->data.or.dispatch = NULL;
+
+    d = malloc(sizeof(mpc_dispatch_t));
+    d->generation = mpc_generation;
+    d->bounds = malloc(sizeof(int) * p->data.or.n);
+    d->skip = calloc(p->data.or.n * 256, 1);
+    d->seen = calloc(p->data.or.n * 256, 1);
+    d->sides = calloc(p->data.or.n * 256, sizeof(mpc_err_t*));
+    d->errors = calloc(p->data.or.n * 256, sizeof(mpc_err_t*));
+
+    for (j = 0; j < p->data.or.n; j++)
+    {
+        d->bounds[j] = mpc_analyse_bound(a, p->data.or.xs[j]);
+        x = mpc_analysis_find(a, p->data.or.xs[j]);
+        if (!x->fixed || x->nullable || d->bounds[j] < 0)
+        {
+            continue;
+        }
+        for (c = 0; c < 256; c++)
+        {
+            d->skip[j * 256 + c] = !(x->first[c / 8] & (1 << (c % 8)));
+        }
+        any = 1;
+    }
+
+    if (any)
+    {
+        p->data.or.dispatch = d;
+    }
+    else
+    {
+        mpc_dispatch_delete(d, p->data.or.n);
+    }
+}
+
+void mpc_analyse(mpc_parser_t *p)
+{
+
+    int j, n;
+    mpc_analysis_t a;
+    mpc_parser_t **ors;
+
+    a.nodes = NULL;
+    a.size = 0;
+    a.num = 0;
+    a.pass = 0;
+
+    do
+    {
+        a.pass++;
+        a.changed = 0;
+        mpc_analyse_node(&a, p);
+    }
+    while (a.changed);
+
+    /* The table can grow while bounds are worked out, so collect the `or` parsers first */
+    ors = malloc(sizeof(mpc_parser_t*) * a.num);
+    n = 0;
+    for (j = 0; j < a.size; j++)
+    {
+        if (a.nodes[j].p && a.nodes[j].p->type == MPC_TYPE_OR && a.nodes[j].p->data.or.n > 1)
+        {
+            ors[n++] = a.nodes[j].p;
+        }
+    }
+
+    for (j = 0; j < n; j++)
+    {
+        mpc_analyse_dispatch(&a, ors[j]);
+    }
+
+    free(ors);
+    free(a.nodes);
+}
@@ -0,0 +1,271 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lispy.h"
+
+// Tests of the runtime: arithmetic on longs and bignums, pow and powmod,
+// ranges and vectors, and the hand-written reader against the mpc grammar.
+// Each failure is printed, and the exit status is the number of them.
+
+int test_failures = 0;
+
+// Whether two values are equal in type and in everything they hold
+int test_same(lval *x, lval *y)
+{
+    if (x->type != y->type)
+        return 0;
+
+    switch (x->type)
+    {
+    case LVAL_NUM:
+        return x->num == y->num;
+    case LVAL_DBL:
+        return x->dbl == y->dbl;
+    case LVAL_BIG:
+        return x->sign == y->sign && x->size == y->size
+            && memcmp(x->limbs, y->limbs, sizeof(uint32_t) * x->size) == 0;
+    case LVAL_VEC:
+        if (x->len != y->len || !x->ints != !y->ints)
+            return 0;
+        return x->ints ? memcmp(x->ints, y->ints, sizeof(long) * x->len) == 0
+                       : memcmp(x->dbls, y->dbls, sizeof(double) * x->len) == 0;
+    case LVAL_MAT:
+        return x->rows == y->rows && x->cols == y->cols
+            && memcmp(x->dbls, y->dbls, sizeof(double) * x->rows * x->cols) == 0;
+    case LVAL_RANGE:
+        return x->start == y->start && x->stop == y->stop && x->step == y->step;
+    case LVAL_ERR:
+        return strcmp(x->err, y->err) == 0;
+    case LVAL_SYM:
+        return strcmp(x->sym, y->sym) == 0;
+    case LVAL_FUN:
+        return x->fun == y->fun;
+    }
+
+    if (x->count != y->count)
+        return 0;
+    for (int i = 0; i < x->count; i++)
+    {
+        if (!test_same(x->cell[i], y->cell[i]))
+            return 0;
+    }
+    return 1;
+}
+
+// Reads src with the hand-written reader, which writes into its input, so
+// from a copy of it
+lval *test_read(char *src)
+{
+    char *s = malloc(strlen(src) + 1);
+    strcpy(s, src);
+    lval *x = lval_read_str(s);
+    free(s);
+    return x;
+}
+
+lval *test_eval(lenv *e, char *src)
+{
+    lval *x = test_read(src);
+    return x ? lval_eval(e, x) : lval_err("cannot read %s", src);
+}
+
+void test_fail(char *src, lval *got)
+{
+    printf("FAIL: %s\n  got ", src);
+    lval_println(got);
+    test_failures++;
+}
+
+// Checks that src evaluates to the same value as want
+void test_value(lenv *e, char *src, char *want)
+{
+    lval *x = test_eval(e, src);
+    lval *y = test_eval(e, want);
+    if (!test_same(x, y))
+        test_fail(src, x);
+    lval_del(x);
+    lval_del(y);
+}
+
+// Checks that src is an error with the message err
+void test_error(lenv *e, char *src, char *err)
+{
+    lval *x = test_eval(e, src);
+    if (x->type != LVAL_ERR || strcmp(x->err, err) != 0)
+        test_fail(src, x);
+    lval_del(x);
+}
+
+// Operands of 47 and 44 limbs, enough that their product is done by
+// Karatsuba multiplication, and that product
+#define TEST_A \
+    "282454250295217455514991435276686729777240366681406512211055412378396955" \
+    "629254094394591128904200942346284899189332081278927588929878572528499708" \
+    "364307662091885755418650330342081003614798479496854322491325977698144142" \
+    "115294202490927480099200617729505092632812490095601366365761716339587306" \
+    "257485435414054513576769924780071543066444251846376378567043114310783556" \
+    "284638445507803913510776650042048071407821921192137369923257928430488357" \
+    "92508243242903486426"
+#define TEST_B \
+    "178571568187186066354433113486424044940444850807424954276388539312925359" \
+    "714960480502568751705937268302277367628181557405018128878779011093690095" \
+    "387140128453406853040696508334477869773257382728608661709026620692826804" \
+    "494879637731074250142202505644843158403753546188575439710475427401065348" \
+    "207221919802568846516416094589671521166442898809301866926678130625618479" \
+    "19614356340493550813367401684727757756641658945822402043761774"
+#define TEST_AB \
+    "504382984163529439701345015659173446835886598758555742387819412234781808" \
+    "216681481947220021160257616834994789300508551785482731720445170023529753" \
+    "238658480984249446958238241489197713070978132312605201347067994637311434" \
+    "769697247931946253521215265800690028896692126563212604447646879553801151" \
+    "506669713660757658365206655575684711375013147664101726439629261416840384" \
+    "982838284311805153825913861040985907274774914579096140819465673961790591" \
+    "069873992526908042525750711900050114147370525846271374766704893145774772" \
+    "443009756261992958959343342445719732180303254221207938991435957679128604" \
+    "404705468545019632483292850233616142385137693807446467237261463520609565" \
+    "337913489175178101874340441660043549602265110444566403282063536328235423" \
+    "549509825184023931479116429659940914525239499181692708060878809392482289" \
+    "960736036939924582214164228939714006211750353274758037067235927546684728" \
+    "786679724"
+
+void test_numbers(lenv *e)
+{
+    test_value(e, "(+ 9223372036854775807 1)", "9223372036854775808");
+    test_value(e, "(- -9223372036854775807 2)", "-9223372036854775809");
+    test_value(e, "(* 4294967296 4294967296)", "18446744073709551616");
+    test_value(e, "(- 18446744073709551616 18446744073709551615)", "1");
+    test_value(e, "(/ 18446744073709551616 4294967296)", "4294967296");
+    test_value(e, "(/ 7 2)", "3");
+    test_value(e, "(/ 7.0 2)", "3.5");
+    test_error(e, "(/ 10 0)", "Division By Zero!");
+
+    test_value(e, "(* " TEST_A " " TEST_B ")", TEST_AB);
+    test_value(e, "(* " TEST_B " (- 0 " TEST_A "))", "(- 0 " TEST_AB ")");
+    test_value(e, "(/ " TEST_AB " " TEST_B ")", TEST_A);
+    test_value(e, "(- " TEST_AB " (* " TEST_A " " TEST_B "))", "0");
+
+    // Thousands of limbs, squared through several levels of Karatsuba
+    test_value(e, "(- (* (+ (^ 3 20000) 1) (- (^ 3 20000) 1)) (* (^ 3 20000) (^ 3 20000)))", "-1");
+    test_value(e, "(/ (* (^ 7 9000) (^ 3 11000)) (^ 3 11000))", "(^ 7 9000)");
+    test_value(e, "(product (range 1 21))", "2432902008176640000");
+    test_value(e, "(product (range 1 22))", "51090942171709440000");
+}
+
+void test_pow(lenv *e)
+{
+    test_value(e, "(^ 2 100)", "1267650600228229401496703205376");
+    test_value(e, "(^ -3 3)", "-27");
+    test_value(e, "(^ 0 0)", "1");
+    test_value(e, "(pow 1 1000000000000)", "1");
+    test_error(e, "(^ 2 -1)", "Function 'pow' called with negative exponent");
+    test_error(e, "(^ 2 (^ 2 40))", "Function 'pow' result would have more than 4194304 bits");
+
+    test_value(e, "(powmod 4 13 497)", "445");
+    test_value(e, "(powmod 2 1000 1000000007)", "688423210");
+    test_value(e, "(powmod 3 (^ 10 30) 1000000007)", "965115194");
+    test_error(e, "(powmod 2 10 0)", "Function 'powmod' called with zero modulus");
+}
+
+void test_vectors(lenv *e)
+{
+    test_value(e, "(sum (range 10))", "45");
+    test_value(e, "(sum (range 10 0 -3))", "22");
+    test_value(e, "(sum (range -9223372036854775807 9223372036854775807))", "-9223372036854775807");
+    test_value(e, "(vec (range 5 5))", "(vec {})");
+    test_value(e, "(sum (range 7 2))", "0");
+    test_error(e, "(range 1 10 0)", "Function 'range' called with step 0");
+    test_error(e, "(vec (range 0 9223372036854775807))", "Function 'vec' called with range too long to store");
+
+    test_value(e, "(vec (range 1 4))", "(vec {1 2 3})");
+    test_value(e, "(+ (vec {1 2 3}) (vec {10 20 30}))", "(vec {11 22 33})");
+    test_value(e, "(* (vec {1 2 3}) 2)", "(vec {2 4 6})");
+    test_value(e, "(sum (vec {1 2 3}))", "6");
+    test_value(e, "(min (vec {3 1 2}))", "1");
+    test_value(e, "(vec {1 2.5})", "(vec {1.0 2.5})");
+    test_error(e, "(+ (vec {1 2}) (vec {1 2 3}))", "Vector lengths do not match!");
+    test_error(e, "(max (vec {}))", "Function 'max' called with empty {}");
+    test_error(e, "(vec {a})", "Function 'vec' called with element that is not a long or double");
+
+    test_value(e, "(matmul (mat {{1 2} {3 4}}) (mat {{5 6} {7 8}}))", "(mat {{19.0 22.0} {43.0 50.0}})");
+}
+
+// Checks that the hand-written reader accepts src exactly when the mpc
+// grammar does, and reads the same forms from it
+void test_readers(lgrammar *g, char *src)
+{
+    lval *x = test_read(src);
+
+    mpc_result_t r;
+    lval *y = NULL;
+    if (mpc_parse("test", src, g->lispy, &r))
+    {
+        y = lval_read(r.output);
+        mpc_ast_delete(r.output);
+    }
+    else
+    {
+        mpc_err_delete(r.error);
+    }
+
+    if (!x != !y || (x && !test_same(x, y)))
+    {
+        printf("FAIL: the readers disagree on \"%s\"\n", src);
+        test_failures++;
+    }
+
+    if (x)
+        lval_del(x);
+    if (y)
+        lval_del(y);
+}
+
+void test_reader(void)
+{
+    lgrammar g;
+    lgrammar_new(&g);
+
+    char *srcs[] = {
+        "", " \t\n", "(+ 1 2)", "{a {b c}} d", "-", "-5", "--5", "5-", "-5x", "1.5", "-1.5", "1.", ".5",
+        "1.5.2", "9223372036854775807", "9223372036854775808", "-9223372036854775808",
+        "-9223372036854775809", "123456789012345678901234567890", "(", ")", "{)", "(()", "x;",
+        "a\\b", "<=>", "&^!", "1e5", "0007", "-0",
+    };
+    for (int i = 0; i < (int)(sizeof(srcs) / sizeof(srcs[0])); i++)
+        test_readers(&g, srcs[i]);
+
+    // Short strings of the characters the grammar cares about
+    static const char chars[] = "() {}1-2.5x+ab\n9";
+    unsigned long seed = 30;
+    char src[24];
+    for (int i = 0; i < 20000; i++)
+    {
+        int n = (seed >> 16) % sizeof(src);
+        for (int j = 0; j < n; j++)
+        {
+            seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+            src[j] = chars[(seed >> 33) % (sizeof(chars) - 1)];
+        }
+        src[n] = '\0';
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        test_readers(&g, src);
+    }
+
+    lgrammar_del(&g);
+}
+
+int main(void)
+{
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    test_numbers(e);
+    test_pow(e);
+    test_vectors(e);
+    test_reader();
+
+    lenv_del(e);
+
+    if (test_failures)
+        printf("%d failed\n", test_failures);
+    return test_failures != 0;
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpc.h"
+
+// Tests that mpc gives the ASTs and errors it gave before its DFA regexes,
+// the dispatch on the next character of alternatives, packrat memoizing and
+// slices were added. Generated inputs are parsed with the Lispy grammar and
+// a grammar of JSON-like values, under every combination of the flags, and
+// a digest of the results is checked against the one recorded with the mpc
+// this repository started from. Only MPCA_LANG_PREDICTIVE changes what a
+// grammar accepts, so the other flags must give the same results as without
+// them, and the first input they disagree on is reported.
+
+// The digests of the generated inputs, without and with
+// MPCA_LANG_PREDICTIVE
+unsigned long long test_baseline[2] = {
+    0x653db84969143faeULL,
+    0xfd2dd792c1c61b47ULL,
+};
+
+int test_flags[] = {
+    MPCA_LANG_DEFAULT,
+    MPCA_LANG_PACKRAT,
+    MPCA_LANG_SLICES,
+    MPCA_LANG_PACKRAT | MPCA_LANG_SLICES,
+};
+
+#define TEST_INPUTS 20000
+
+// 64-bit FNV-1a
+unsigned long long test_hash(unsigned long long h, const char *s, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// Hashes an AST, which is NULL for an empty match of some grammars. The
+// contents of slices are not terminated, so only contents_len of them are.
+unsigned long long test_hash_ast(unsigned long long h, mpc_ast_t *a)
+{
+    if (a == NULL)
+        return test_hash(h, "", 1);
+
+    char pos[64];
+    int n = sprintf(pos, "%ld:%ld:%ld:%d", a->state.pos, a->state.row, a->state.col, a->children_num);
+    h = test_hash(h, a->tag, strlen(a->tag) + 1);
+    h = test_hash(h, a->contents, a->contents_len);
+    h = test_hash(h, "", 1);
+    h = test_hash(h, pos, n + 1);
+    for (int i = 0; i < a->children_num; i++)
+        h = test_hash_ast(h, a->children[i]);
+    return h;
+}
+
+// Hashes the AST of a successful parse of in, or the message of a failed one
+unsigned long long test_parse(unsigned long long h, mpc_parser_t *p, const char *in)
+{
+    mpc_result_t r;
+    if (mpc_parse("test", in, p, &r))
+    {
+        h = test_hash_ast(h, r.output);
+        mpc_ast_delete(r.output);
+    }
+    else
+    {
+        char *s = mpc_err_string(r.error);
+        h = test_hash(h, s, strlen(s) + 1);
+        free(s);
+        mpc_err_delete(r.error);
+    }
+    return h;
+}
+
+unsigned long long test_seed;
+
+unsigned test_rand(unsigned n)
+{
+    test_seed = test_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned)(test_seed >> 33) % n;
+}
+
+// Parses TEST_INPUTS generated inputs with grammars built with the given
+// flags, and returns the digest of them all. hashes gets the digest of each
+// input on its own.
+unsigned long long test_grammars(int flags, unsigned long long *hashes)
+{
+    mpc_parser_t *Integer = mpc_new("integer"), *Decimal = mpc_new("decimal"), *Number = mpc_new("number");
+    mpc_parser_t *Symbol = mpc_new("symbol"), *Sexpr = mpc_new("sexpr"), *Qexpr = mpc_new("qexpr");
+    mpc_parser_t *Expr = mpc_new("expr"), *Lispy = mpc_new("lispy");
+    mpc_parser_t *Value = mpc_new("value"), *Num = mpc_new("num"), *Str = mpc_new("str"), *List = mpc_new("list");
+    mpc_parser_t *Kw = mpc_new("kw"), *Lr = mpc_new("lr"), *Opt = mpc_new("opt"), *Top = mpc_new("top");
+    mpc_parser_t *Top2 = mpc_new("top2");
+
+    mpc_err_t *err = mpca_lang(flags,
+        " integer : /-?\\d+/ ; decimal : /-?\\d+\\.\\d+/ ; number : <decimal> | <integer> ;"
+        " symbol : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&^]+/ ; sexpr : '(' <expr>* ')' ; qexpr : '{' <expr>* '}' ;"
+        " expr : <number> | <symbol> | <sexpr> | <qexpr> ; lispy : /^/ <expr>* /$/ ;",
+        Integer, Decimal, Number, Symbol, Sexpr, Qexpr, Expr, Lispy, NULL);
+    if (!err)
+    {
+        err = mpca_lang(flags,
+            " value : <num> | <str> | <list> | \"true\" | \"false\" | \"nul\" | <kw> ;"
+            " num : /-?[0-9]+/ ; str : /\"[a-z]*\"/ ; list : '[' (<value> (',' <value>)*)? ']' ;"
+            " kw : \"tr\" 'x' | (\"fa\" | 'n') ;"
+            " lr : <lr> '+' <num> | <num> ;"
+            " opt : 'a'? 'b' | 'c'* 'd' | \"\" ;"
+            " top : /^/ (<value> | '!' <opt> | '?' <lr>) /$/ ; top2 : <value>* ;",
+            Value, Num, Str, List, Kw, Lr, Opt, Top, Top2, NULL);
+    }
+    if (err)
+    {
+        mpc_err_print(err);
+        mpc_err_delete(err);
+        exit(1);
+    }
+
+    static const char lispy[] = "() {}1-2.5x+ab\n";
+    static const char value[] = "[],1-\"atrufalsenx!?abcd+";
+    unsigned long long all = 0xcbf29ce484222325ULL;
+    char in[32];
+    test_seed = 30;
+
+    for (int i = 0; i < TEST_INPUTS; i++)
+    {
+        unsigned long long h = 0xcbf29ce484222325ULL;
+        int n = test_rand(sizeof(in));
+        const char *chars = i % 2 ? lispy : value;
+        int size = i % 2 ? sizeof(lispy) - 1 : sizeof(value) - 1;
+        for (int j = 0; j < n; j++)
+            in[j] = chars[test_rand(size)];
+        in[n] = '\0';
+
+        if (i % 2)
+        {
+            h = test_parse(h, Lispy, in);
+        }
+        else
+        {
+            h = test_parse(h, Top, in);
+            h = test_parse(h, Top2, in);
+            h = test_parse(h, Value, in);
+        }
+
+        hashes[i] = h;
+        all = test_hash(all, (char *)&h, sizeof(h));
+    }
+
+    mpc_cleanup(8, Integer, Decimal, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    mpc_cleanup(9, Value, Num, Str, List, Kw, Lr, Opt, Top, Top2);
+    return all;
+}
+
+int main(void)
+{
+    static unsigned long long base[TEST_INPUTS], hashes[TEST_INPUTS];
+    int failures = 0;
+
+    for (int p = 0; p < 2; p++)
+    {
+        int predictive = p ? MPCA_LANG_PREDICTIVE : 0;
+        unsigned long long all = test_grammars(predictive, base);
+        if (all != test_baseline[p])
+        {
+            printf("FAIL: digest %#llx with flags %d, not %#llx\n", all, predictive, test_baseline[p]);
+            failures++;
+        }
+
+        for (int f = 1; f < (int)(sizeof(test_flags) / sizeof(test_flags[0])); f++)
+        {
+            int flags = predictive | test_flags[f];
+            test_grammars(flags, hashes);
+            for (int i = 0; i < TEST_INPUTS; i++)
+            {
+                if (hashes[i] != base[i])
+                {
+                    printf("FAIL: input %d differs with flags %d\n", i, flags);
+                    failures++;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (failures)
+        printf("%d failed\n", failures);
+    return failures != 0;
+}